@@ -1,23 +1,54 @@
 #include "crypto/AESWrapper.h"
+#include "instrument.h"
 #include <stdexcept>
 #include <cstring>
 #include <cryptopp/aes.h>
 #include <cryptopp/modes.h>
-#include <cryptopp/filters.h>
 #include <cryptopp/osrng.h>
 
 constexpr uint8_t AESWrapper::IV[16];
+constexpr size_t AESWrapper::BLOCK_SIZE;
 
-AESWrapper::AESWrapper() {
-    key = generateKey();
+struct AESWrapper::Impl {
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption;
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption;
+    // For framed IVs; seeded on first use, since most wrappers never need it
+    std::unique_ptr<CryptoPP::AutoSeededRandomPool> rng;
+
+    explicit Impl(const std::vector<uint8_t>& key)
+        : encryption(key.data(), key.size(), IV),
+          decryption(key.data(), key.size(), IV) {}
+};
+
+// Length of the plaintext once the PKCS#7 padding at the end of it is dropped
+static size_t unpaddedSize(const uint8_t* plaintext, size_t length) {
+    uint8_t pad = plaintext[length - 1];
+    if (pad == 0 || pad > AESWrapper::BLOCK_SIZE) {
+        throw std::runtime_error("AES decryption failed: invalid padding");
+    }
+    for (size_t i = length - pad; i < length; i++) {
+        if (plaintext[i] != pad) {
+            throw std::runtime_error("AES decryption failed: invalid padding");
+        }
+    }
+    return length - pad;
 }
 
+AESWrapper::AESWrapper() : key(generateKey()), impl(new Impl(key)) {}
+
 AESWrapper::AESWrapper(const std::vector<uint8_t>& key) : key(key) {
     if (key.size() != KEY_SIZE) {
         throw std::runtime_error("Invalid AES key size");
     }
+    impl.reset(new Impl(key));
 }
 
+AESWrapper::AESWrapper(AESWrapper&& other) = default;
+
+AESWrapper& AESWrapper::operator=(AESWrapper&& other) = default;
+
+AESWrapper::~AESWrapper() = default;
+
 std::vector<uint8_t> AESWrapper::generateKey() {
     std::vector<uint8_t> key(KEY_SIZE);
     CryptoPP::AutoSeededRandomPool rng;
@@ -25,53 +56,174 @@ std::vector<uint8_t> AESWrapper::generateKey() {
     return key;
 }
 
-std::vector<uint8_t> AESWrapper::encrypt(const std::vector<uint8_t>& plaintext) {
+// CBC with PKCS#7 padding under iv; out may be in
+static size_t encryptCbc(CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption& encryption, const uint8_t* iv,
+                         const uint8_t* in, size_t length, uint8_t* out) {
+    constexpr size_t BLOCK_SIZE = AESWrapper::BLOCK_SIZE;
+
+    // Pad the partial last block on the side before out can overwrite it
+    size_t full = length - length % BLOCK_SIZE;
+    uint8_t last[BLOCK_SIZE];
+    size_t tail = length - full;
+    std::memcpy(last, in + full, tail);
+    std::memset(last + tail, static_cast<int>(BLOCK_SIZE - tail), BLOCK_SIZE - tail);
+
     try {
-        CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption;
-        encryption.SetKeyWithIV(key.data(), KEY_SIZE, IV);
-        
-        std::string ciphertext;
-        CryptoPP::StringSource ss(
-            plaintext.data(), plaintext.size(), true,
-            new CryptoPP::StreamTransformationFilter(
-                encryption,
-                new CryptoPP::StringSink(ciphertext)
-            )
-        );
-        
-        return std::vector<uint8_t>(ciphertext.begin(), ciphertext.end());
+        encryption.Resynchronize(iv);
+        if (full > 0) {
+            encryption.ProcessData(out, in, full);
+        }
+        encryption.ProcessData(out + full, last, BLOCK_SIZE);
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("AES encryption failed: ") + e.what());
     }
+    return full + BLOCK_SIZE;
+}
+
+static size_t decryptCbc(CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption& decryption, const uint8_t* iv,
+                         const uint8_t* in, size_t length, uint8_t* out) {
+    if (length == 0 || length % AESWrapper::BLOCK_SIZE != 0) {
+        throw std::runtime_error("AES decryption failed: ciphertext is not a whole number of blocks");
+    }
+
+    try {
+        decryption.Resynchronize(iv);
+        decryption.ProcessData(out, in, length);
+    } catch (const CryptoPP::Exception& e) {
+        throw std::runtime_error(std::string("AES decryption failed: ") + e.what());
+    }
+    return unpaddedSize(out, length);
+}
+
+size_t AESWrapper::encrypt(const uint8_t* in, size_t length, uint8_t* out) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_ENCRYPT);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    return encryptCbc(impl->encryption, IV, in, length, out);
+}
+
+size_t AESWrapper::decrypt(const uint8_t* in, size_t length, uint8_t* out) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_DECRYPT);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    return decryptCbc(impl->decryption, IV, in, length, out);
+}
+
+size_t AESWrapper::encryptFramed(uint8_t* chunk, size_t length) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_ENCRYPT);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    if (!impl->rng) {
+        impl->rng.reset(new CryptoPP::AutoSeededRandomPool);
+    }
+    impl->rng->GenerateBlock(chunk, IV_SIZE);
+    return IV_SIZE + encryptCbc(impl->encryption, chunk, chunk + IV_SIZE, length, chunk + IV_SIZE);
+}
+
+size_t AESWrapper::decryptFramed(uint8_t* chunk, size_t length) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_DECRYPT);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    if (length < IV_SIZE) {
+        throw std::runtime_error("AES decryption failed: chunk is shorter than its IV");
+    }
+    return decryptCbc(impl->decryption, chunk, chunk + IV_SIZE, length - IV_SIZE, chunk + IV_SIZE);
+}
+
+void AESWrapper::encryptInPlace(std::vector<uint8_t>& data) {
+    size_t length = data.size();
+    data.resize(ciphertextSize(length));
+    encrypt(data.data(), length, data.data());
+}
+
+void AESWrapper::decryptInPlace(std::vector<uint8_t>& data) {
+    data.resize(decrypt(data.data(), data.size(), data.data()));
+}
+
+std::vector<uint8_t> AESWrapper::encrypt(const std::vector<uint8_t>& plaintext) {
+    std::vector<uint8_t> ciphertext(ciphertextSize(plaintext.size()));
+    encrypt(plaintext.data(), plaintext.size(), ciphertext.data());
+    return ciphertext;
 }
 
 std::vector<uint8_t> AESWrapper::encrypt(const std::string& plaintext) {
-    std::vector<uint8_t> data(plaintext.begin(), plaintext.end());
-    return encrypt(data);
+    std::vector<uint8_t> ciphertext(ciphertextSize(plaintext.size()));
+    encrypt(reinterpret_cast<const uint8_t*>(plaintext.data()), plaintext.size(), ciphertext.data());
+    return ciphertext;
 }
 
 std::vector<uint8_t> AESWrapper::decrypt(const std::vector<uint8_t>& ciphertext) {
+    std::vector<uint8_t> plaintext(ciphertext);
+    decryptInPlace(plaintext);
+    return plaintext;
+}
+
+std::string AESWrapper::decryptToString(const std::vector<uint8_t>& ciphertext) {
+    std::string plaintext(ciphertext.begin(), ciphertext.end());
+    uint8_t* data = reinterpret_cast<uint8_t*>(&plaintext[0]);
+    plaintext.resize(decrypt(data, plaintext.size(), data));
+    return plaintext;
+}
+
+
+struct AESWrapper::Decryptor::Impl {
+    // Keeps the CBC chain between updates, so it is never resynchronized
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption;
+    // The last 1-16 bytes seen, which may turn out to be the padded final block
+    uint8_t held[BLOCK_SIZE];
+    size_t held_size;
+
+    explicit Impl(const std::vector<uint8_t>& key)
+        : decryption(key.data(), key.size(), IV), held_size(0) {}
+};
+
+AESWrapper::Decryptor::Decryptor(const AESWrapper& aes) : impl(new Impl(aes.key)) {}
+
+AESWrapper::Decryptor::~Decryptor() = default;
+
+void AESWrapper::Decryptor::update(const uint8_t* data, size_t length, std::vector<uint8_t>& out) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_DECRYPT);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    out.clear();
+
+    size_t total = impl->held_size + length;
+    if (total <= BLOCK_SIZE) {
+        std::memcpy(impl->held + impl->held_size, data, length);
+        impl->held_size = total;
+        return;
+    }
+
+    // Everything but the last (possibly partial) block can be decrypted now
+    size_t keep = total % BLOCK_SIZE == 0 ? BLOCK_SIZE : total % BLOCK_SIZE;
+    out.resize(total - keep);
+    uint8_t* dest = out.data();
     try {
-        CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption;
-        decryption.SetKeyWithIV(key.data(), KEY_SIZE, IV);
-        
-        std::string plaintext;
-        CryptoPP::StringSource ss(
-            ciphertext.data(), ciphertext.size(), true,
-            new CryptoPP::StreamTransformationFilter(
-                decryption,
-                new CryptoPP::StringSink(plaintext)
-            )
-        );
-        
-        return std::vector<uint8_t>(plaintext.begin(), plaintext.end());
+        if (impl->held_size > 0) {
+            size_t fill = BLOCK_SIZE - impl->held_size;
+            std::memcpy(impl->held + impl->held_size, data, fill);
+            impl->decryption.ProcessData(dest, impl->held, BLOCK_SIZE);
+            data += fill;
+            length -= fill;
+            dest += BLOCK_SIZE;
+        }
+        size_t bulk = length - keep;
+        if (bulk > 0) {
+            impl->decryption.ProcessData(dest, data, bulk);
+        }
+        std::memcpy(impl->held, data + bulk, keep);
+        impl->held_size = keep;
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("AES decryption failed: ") + e.what());
     }
 }
 
-std::string AESWrapper::decryptToString(const std::vector<uint8_t>& ciphertext) {
-    auto plaintext = decrypt(ciphertext);
-    return std::string(plaintext.begin(), plaintext.end());
-}
+void AESWrapper::Decryptor::finish(std::vector<uint8_t>& out) {
+    if (impl->held_size != BLOCK_SIZE) {
+        throw std::runtime_error("AES decryption failed: ciphertext is not a whole number of blocks");
+    }
 
+    out.resize(BLOCK_SIZE);
+    try {
+        impl->decryption.ProcessData(out.data(), impl->held, BLOCK_SIZE);
+    } catch (const CryptoPP::Exception& e) {
+        throw std::runtime_error(std::string("AES decryption failed: ") + e.what());
+    }
+    impl->held_size = 0;
+    out.resize(unpaddedSize(out.data(), BLOCK_SIZE));
+}
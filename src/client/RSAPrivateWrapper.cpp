@@ -1,4 +1,5 @@
 #include "crypto/RSAPrivateWrapper.h"
+#include "instrument.h"
 #include <fstream>
 #include <stdexcept>
 #include <cryptopp/rsa.h>
@@ -6,6 +7,13 @@
 #include <cryptopp/base64.h>
 #include <cryptopp/queue.h>
 
+struct RSAPrivateWrapper::Impl {
+    CryptoPP::AutoSeededRandomPool rng;
+    CryptoPP::RSAES_OAEP_SHA_Decryptor decryptor;
+    
+    explicit Impl(const CryptoPP::RSA::PrivateKey& key) : decryptor(key) {}
+};
+
 RSAPrivateWrapper::RSAPrivateWrapper() {
     try {
         CryptoPP::AutoSeededRandomPool rng;
@@ -28,6 +36,8 @@ RSAPrivateWrapper::RSAPrivateWrapper() {
         } else if (public_key.size() < PUBLIC_KEY_SIZE) {
             public_key.resize(PUBLIC_KEY_SIZE, 0);
         }
+        
+        impl.reset(new Impl(privateKey));
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("RSA key generation failed: ") + e.what());
     }
@@ -51,30 +61,36 @@ RSAPrivateWrapper::RSAPrivateWrapper(const std::vector<uint8_t>& private_key)
         } else if (public_key.size() < PUBLIC_KEY_SIZE) {
             public_key.resize(PUBLIC_KEY_SIZE, 0);
         }
+        
+        impl.reset(new Impl(privateKey));
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("RSA key loading failed: ") + e.what());
     }
 }
 
+RSAPrivateWrapper::RSAPrivateWrapper(RSAPrivateWrapper&& other) = default;
+RSAPrivateWrapper& RSAPrivateWrapper::operator=(RSAPrivateWrapper&& other) = default;
+RSAPrivateWrapper::~RSAPrivateWrapper() = default;
+
 std::vector<uint8_t> RSAPrivateWrapper::decrypt(const std::vector<uint8_t>& ciphertext) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_DECRYPT);
+    INSTRUMENT_ADD_BYTES(timer, ciphertext.size());
     try {
-        CryptoPP::RSA::PrivateKey privateKey;
-        CryptoPP::ArraySource as(private_key.data(), private_key.size(), true);
-        privateKey.Load(as);
-        
-        CryptoPP::AutoSeededRandomPool rng;
-        CryptoPP::RSAES_OAEP_SHA_Decryptor decryptor(privateKey);
+        size_t max_length = impl->decryptor.MaxPlaintextLength(ciphertext.size());
+        if (max_length == 0) {
+            throw std::runtime_error("RSA decryption failed: invalid ciphertext length");
+        }
         
-        std::string plaintext;
-        CryptoPP::StringSource ss(
-            ciphertext.data(), ciphertext.size(), true,
-            new CryptoPP::PK_DecryptorFilter(
-                rng, decryptor,
-                new CryptoPP::StringSink(plaintext)
-            )
+        std::vector<uint8_t> plaintext(max_length);
+        CryptoPP::DecodingResult result = impl->decryptor.Decrypt(
+            impl->rng, ciphertext.data(), ciphertext.size(), plaintext.data()
         );
+        if (!result.isValidCoding) {
+            throw std::runtime_error("RSA decryption failed: invalid padding");
+        }
         
-        return std::vector<uint8_t>(plaintext.begin(), plaintext.end());
+        plaintext.resize(result.messageLength);
+        return plaintext;
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("RSA decryption failed: ") + e.what());
     }
@@ -1,35 +1,51 @@
 #include "crypto/RSAPublicWrapper.h"
+#include "instrument.h"
 #include <stdexcept>
 #include <cryptopp/rsa.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/base64.h>
 
+struct RSAPublicWrapper::Impl {
+    CryptoPP::AutoSeededRandomPool rng;
+    CryptoPP::RSAES_OAEP_SHA_Encryptor encryptor;
+    
+    explicit Impl(const CryptoPP::RSA::PublicKey& key) : encryptor(key) {}
+};
+
 RSAPublicWrapper::RSAPublicWrapper(const std::vector<uint8_t>& public_key) 
     : public_key(public_key) {
     if (public_key.size() != KEY_SIZE) {
         throw std::runtime_error("Invalid RSA public key size");
     }
-}
-
-std::vector<uint8_t> RSAPublicWrapper::encrypt(const std::vector<uint8_t>& plaintext) {
+    
     try {
         CryptoPP::RSA::PublicKey publicKey;
         CryptoPP::ArraySource as(public_key.data(), public_key.size(), true);
         publicKey.Load(as);
         
-        CryptoPP::AutoSeededRandomPool rng;
-        CryptoPP::RSAES_OAEP_SHA_Encryptor encryptor(publicKey);
+        impl.reset(new Impl(publicKey));
+    } catch (const CryptoPP::Exception& e) {
+        throw std::runtime_error(std::string("RSA public key loading failed: ") + e.what());
+    }
+}
+
+RSAPublicWrapper::RSAPublicWrapper(RSAPublicWrapper&& other) = default;
+RSAPublicWrapper& RSAPublicWrapper::operator=(RSAPublicWrapper&& other) = default;
+RSAPublicWrapper::~RSAPublicWrapper() = default;
+
+std::vector<uint8_t> RSAPublicWrapper::encrypt(const std::vector<uint8_t>& plaintext) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_ENCRYPT);
+    INSTRUMENT_ADD_BYTES(timer, plaintext.size());
+    try {
+        size_t ciphertext_length = impl->encryptor.CiphertextLength(plaintext.size());
+        if (ciphertext_length == 0) {
+            throw std::runtime_error("RSA encryption failed: plaintext too long");
+        }
         
-        std::string ciphertext;
-        CryptoPP::StringSource ss(
-            plaintext.data(), plaintext.size(), true,
-            new CryptoPP::PK_EncryptorFilter(
-                rng, encryptor,
-                new CryptoPP::StringSink(ciphertext)
-            )
-        );
+        std::vector<uint8_t> ciphertext(ciphertext_length);
+        impl->encryptor.Encrypt(impl->rng, plaintext.data(), plaintext.size(), ciphertext.data());
         
-        return std::vector<uint8_t>(ciphertext.begin(), ciphertext.end());
+        return ciphertext;
     } catch (const CryptoPP::Exception& e) {
         throw std::runtime_error(std::string("RSA encryption failed: ") + e.what());
     }
@@ -39,4 +55,3 @@ std::vector<uint8_t> RSAPublicWrapper::encrypt(const std::string& plaintext) {
     std::vector<uint8_t> data(plaintext.begin(), plaintext.end());
     return encrypt(data);
 }
-
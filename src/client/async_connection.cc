@@ -0,0 +1,221 @@
+#include "async_connection.h"
+#include "event_loop.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+AsyncConnection::AsyncConnection(EventLoop& loop, const std::string& host, int port)
+    : loop(loop), host(host), port(port), sock(-1), state(State::Closed), output_offset(0),
+      header_read(0), header{0, 0, 0}, payload_read(0), reading_payload(false) {}
+
+AsyncConnection::~AsyncConnection() {
+    close();
+}
+
+void AsyncConnection::submit(std::vector<uint8_t> request, Handler handler) {
+    output.push_back(std::move(request));
+    pending.push_back(std::move(handler));
+
+    if (state == State::Closed) {
+        open();
+        return;
+    }
+    if (state == State::Open) {
+        writeOutput();
+    }
+}
+
+void AsyncConnection::close() {
+    fail();
+}
+
+void AsyncConnection::open() {
+    sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        fail();
+        return;
+    }
+
+    struct sockaddr_in server_addr;
+    std::memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
+        fail();
+        return;
+    }
+
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    state = State::Connecting;
+    if (::connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS) {
+        fail();
+        return;
+    }
+
+    // Writable once the handshake completes (or fails, reported via SO_ERROR)
+    loop.watch(sock, EPOLLOUT, [this](uint32_t events) { onEvents(events); });
+}
+
+void AsyncConnection::onEvents(uint32_t events) {
+    if (state == State::Connecting) {
+        finishConnect();
+        return;
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        // Read first: the server may have answered everything before closing
+        readInput();
+        if (state == State::Open) {
+            fail();
+        }
+        return;
+    }
+    if (events & EPOLLIN) {
+        readInput();
+    }
+    if (state == State::Open && (events & EPOLLOUT)) {
+        writeOutput();
+    }
+}
+
+void AsyncConnection::finishConnect() {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        fail();
+        return;
+    }
+
+    state = State::Open;
+    updateInterest();
+    writeOutput();
+}
+
+void AsyncConnection::writeOutput() {
+    while (!output.empty()) {
+        const std::vector<uint8_t>& front = output.front();
+        ssize_t sent = send(sock, front.data() + output_offset, front.size() - output_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            fail();
+            return;
+        }
+
+        output_offset += static_cast<size_t>(sent);
+        if (output_offset == front.size()) {
+            output.pop_front();
+            output_offset = 0;
+        }
+    }
+    updateInterest();
+}
+
+void AsyncConnection::readInput() {
+    while (state == State::Open) {
+        ssize_t received;
+        if (!reading_payload) {
+            received = recv(sock, header_buffer + header_read, sizeof(header_buffer) - header_read, 0);
+        } else {
+            received = recv(sock, payload.data() + payload_read, payload.size() - payload_read, 0);
+        }
+
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail();
+            }
+            return;
+        }
+        if (received == 0) {
+            fail();
+            return;
+        }
+
+        if (!reading_payload) {
+            header_read += static_cast<size_t>(received);
+            if (header_read < sizeof(header_buffer)) {
+                continue;
+            }
+            header = Protocol::unpackResponseHeader(
+                std::vector<uint8_t>(header_buffer, header_buffer + sizeof(header_buffer)));
+            header_read = 0;
+            payload.assign(header.payload_size, 0);
+            payload_read = 0;
+            reading_payload = true;
+        } else {
+            payload_read += static_cast<size_t>(received);
+        }
+
+        if (reading_payload && payload_read == payload.size()) {
+            reading_payload = false;
+            deliver();
+        }
+    }
+}
+
+void AsyncConnection::deliver() {
+    if (pending.empty()) {
+        // A response nobody asked for: the stream is out of step
+        fail();
+        return;
+    }
+
+    Handler handler = std::move(pending.front());
+    pending.pop_front();
+    if (handler) {
+        handler(true, header, payload);
+    }
+}
+
+void AsyncConnection::updateInterest() {
+    if (state != State::Open) {
+        return;
+    }
+    // Only ask for writability while there is something left to write
+    uint32_t events = EPOLLIN;
+    if (!output.empty()) {
+        events |= EPOLLOUT;
+    }
+    loop.modify(sock, events);
+}
+
+void AsyncConnection::fail() {
+    if (sock >= 0) {
+        loop.unwatch(sock);
+        ::close(sock);
+        sock = -1;
+    }
+    state = State::Closed;
+    output.clear();
+    output_offset = 0;
+    header_read = 0;
+    payload_read = 0;
+    reading_payload = false;
+
+    // Handlers may submit again, which reopens the socket for new requests only
+    std::deque<Handler> failed;
+    failed.swap(pending);
+    ResponseHeader empty_header = {0, 0, 0};
+    std::vector<uint8_t> empty_payload;
+    for (auto& handler : failed) {
+        if (handler) {
+            handler(false, empty_header, empty_payload);
+        }
+    }
+}
@@ -0,0 +1,538 @@
+#include "background.h"
+#include "chunk_cipher.h"
+#include "compression.h"
+#include "crypto/AESWrapper.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <cstdio>
+#include <cstring>
+
+// Between attempts to reopen the wait request while the server is unreachable
+static constexpr unsigned MESSAGE_WAIT_RETRY_MS = 2000;
+// Polling interval for a server that refuses wait requests
+static constexpr unsigned MESSAGE_WAIT_FALLBACK_POLL_MS = 5000;
+
+struct BackgroundTasks::Upload {
+    uint32_t job_id;
+    uint8_t from_id[CLIENT_ID_SIZE];
+    uint8_t target_id[CLIENT_ID_SIZE];
+    std::ifstream file;
+    std::unique_ptr<ChunkCipher> cipher;
+    // Encrypted chunk requests not sent yet, prefix still to be filled in
+    std::deque<std::vector<uint8_t>> ready;
+    // Sent as REQ_SEND_FILE_CHUNK_COMPRESSED
+    bool compressed;
+    uint32_t transfer_id;
+    uint32_t chunk_count;
+    uint32_t next_index;
+    uint32_t acked;
+    uint64_t encrypted_total;
+    bool failed;
+};
+
+struct BackgroundTasks::Download {
+    uint32_t job_id;
+    uint8_t client_id[CLIENT_ID_SIZE];
+    uint32_t message_id;
+    // Which chunk framing the file uses
+    uint8_t msg_type;
+    std::string path;
+    std::ofstream out;
+    std::unique_ptr<ChunkCipher> cipher;
+    // Chunks received but not decrypted yet
+    std::vector<std::vector<uint8_t>> batch;
+    uint32_t chunk_count;
+    uint32_t next_index;
+    uint32_t received;
+    uint64_t written;
+    bool failed;
+};
+
+// Background output goes between menu prompts, so keep each notice on its own line
+static void notice(const std::string& text) {
+    static std::mutex output_mutex;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cout << "\n[background] " << text << std::endl;
+}
+
+BackgroundTasks::BackgroundTasks(const std::string& host, int port, WorkerPool& crypto_pool)
+    : connection(loop, host, port), wait_connection(loop, host, port), crypto_pool(crypto_pool),
+      next_job_id(1), active(0), acks_in_flight(0), poll_cursor(0), polling(false), poll_in_flight(false),
+      poll_timer(-1), receiving(false), wait_in_flight(false), wait_retry_timer(-1), ack_wanted(0), ack_sent(0),
+      failed_download(0) {
+    loop.start();
+}
+
+BackgroundTasks::~BackgroundTasks() {
+    loop.post([this]() {
+        if (poll_timer >= 0) {
+            loop.cancelTimer(poll_timer);
+            poll_timer = -1;
+        }
+        // Closing fails the open wait request, which must not start another
+        receiving = false;
+        if (wait_retry_timer >= 0) {
+            loop.cancelTimer(wait_retry_timer);
+            wait_retry_timer = -1;
+        }
+        connection.close();
+        wait_connection.close();
+    });
+    loop.stop();
+}
+
+void BackgroundTasks::upload(const uint8_t* from_id, const uint8_t* target_id, const std::string& target_name,
+                             const std::string& path, const std::vector<uint8_t>& key) {
+    auto job = std::make_shared<Upload>();
+    std::memcpy(job->from_id, from_id, CLIENT_ID_SIZE);
+    std::memcpy(job->target_id, target_id, CLIENT_ID_SIZE);
+    job->compressed = compression::builtIn() != compression::CODEC_NONE;
+    job->cipher.reset(new ChunkCipher(crypto_pool, key, job->compressed));
+    job->next_index = 0;
+    job->acked = 0;
+    job->encrypted_total = 0;
+    job->failed = false;
+    job->job_id = addJob("upload " + path + " to " + target_name);
+
+    job->file.open(path, std::ios::binary | std::ios::ate);
+    if (!job->file) {
+        finishJob(job->job_id, false, "could not open " + path);
+        return;
+    }
+    uint64_t file_size = static_cast<uint64_t>(job->file.tellg());
+    job->file.seekg(0);
+    job->chunk_count = static_cast<uint32_t>((file_size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE);
+    if (job->chunk_count == 0) {
+        finishJob(job->job_id, false, "file is empty");
+        return;
+    }
+
+    std::random_device random;
+    job->transfer_id = random();
+    updateJob(job->job_id, 0, job->chunk_count);
+
+    loop.post([this, job]() { pumpUpload(job); });
+}
+
+void BackgroundTasks::pumpUpload(const std::shared_ptr<Upload>& job) {
+    // Keep up to FILE_CHUNK_WINDOW chunks awaiting their ack
+    while (!job->failed && job->next_index < job->chunk_count &&
+           job->next_index - job->acked < FILE_CHUNK_WINDOW) {
+        if (job->ready.empty()) {
+            // Read the next batch and encrypt it across the pool; the loop
+            // waits for it, but for less time than encrypting one by one.
+            // Each chunk is read and encrypted right where it goes in its request.
+            const size_t chunk_offset = FILE_CHUNK_PREFIX_SIZE + AESWrapper::IV_SIZE;
+            std::vector<std::vector<uint8_t>> batch(
+                std::min<size_t>(job->cipher->batchSize(), job->chunk_count - job->next_index));
+            for (auto& request : batch) {
+                request.reserve(FILE_CHUNK_PREFIX_SIZE +
+                                AESWrapper::framedSize(FILE_CHUNK_SIZE + compression::FRAME_HEADER_SIZE));
+                request.resize(chunk_offset + FILE_CHUNK_SIZE);
+                job->file.read(reinterpret_cast<char*>(request.data() + chunk_offset), FILE_CHUNK_SIZE);
+                size_t chunk_size = static_cast<size_t>(job->file.gcount());
+                if (chunk_size == 0) {
+                    job->failed = true;
+                    finishJob(job->job_id, false, "file shrank while it was being sent");
+                    return;
+                }
+                request.resize(chunk_offset + chunk_size);
+            }
+            try {
+                job->cipher->encrypt(batch, FILE_CHUNK_PREFIX_SIZE);
+            } catch (const std::exception& e) {
+                job->failed = true;
+                finishJob(job->job_id, false, e.what());
+                return;
+            }
+            for (auto& request : batch) {
+                job->ready.push_back(std::move(request));
+            }
+        }
+
+        std::vector<uint8_t> request = std::move(job->ready.front());
+        job->ready.pop_front();
+        size_t encrypted_size = request.size() - FILE_CHUNK_PREFIX_SIZE;
+        uint32_t index = job->next_index++;
+
+        Protocol::packFileChunkPrefix(request.data(), job->from_id, job->target_id, job->transfer_id,
+                                      index, index + 1 == job->chunk_count, job->compressed, encrypted_size);
+        job->encrypted_total += encrypted_size;
+
+        connection.submit(std::move(request), [this, job](bool ok, const ResponseHeader& header,
+                                                          std::vector<uint8_t>&) {
+            if (job->failed) {
+                return;
+            }
+            if (!ok || header.code != RES_FILE_CHUNK_STORED) {
+                job->failed = true;
+                finishJob(job->job_id, false, ok ? "server rejected a chunk" : "connection lost");
+                return;
+            }
+
+            job->acked++;
+            updateJob(job->job_id, job->acked, job->chunk_count);
+            if (job->acked == job->chunk_count) {
+                finishJob(job->job_id, true, std::to_string(job->encrypted_total) + " encrypted bytes sent");
+                return;
+            }
+            pumpUpload(job);
+        });
+    }
+}
+
+void BackgroundTasks::download(const uint8_t* client_id, const Message& msg, const std::string& sender_name,
+                               const std::vector<uint8_t>& key, const std::string& path) {
+    auto job = std::make_shared<Download>();
+    std::memcpy(job->client_id, client_id, CLIENT_ID_SIZE);
+    job->message_id = msg.id;
+    job->msg_type = msg.type;
+    job->path = path;
+    job->cipher.reset(new ChunkCipher(crypto_pool, key, msg.type == MSG_TYPE_FILE_CHUNKED_COMPRESSED));
+    job->next_index = 0;
+    job->received = 0;
+    job->written = 0;
+    job->failed = false;
+    job->job_id = addJob("download of file " + std::to_string(msg.id) + " from " + sender_name);
+
+    uint32_t message_id = msg.id;
+    std::string error;
+    try {
+        job->chunk_count = MessageUtils::parseFileDescriptor(msg.content).chunk_count;
+        job->out.open(path, std::ios::binary);
+        if (!job->out) {
+            error = "could not create " + path;
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    if (!error.empty()) {
+        loop.post([this, message_id]() { downloadFinished(message_id, false); });
+        finishJob(job->job_id, false, error);
+        return;
+    }
+    updateJob(job->job_id, 0, job->chunk_count);
+
+    // Registered before any acknowledgement posted after this call
+    loop.post([this, job]() {
+        downloading.insert(job->message_id);
+        pumpDownload(job);
+    });
+}
+
+void BackgroundTasks::pumpDownload(const std::shared_ptr<Download>& job) {
+    while (!job->failed && job->next_index < job->chunk_count &&
+           job->next_index - job->received < FILE_CHUNK_WINDOW) {
+        uint32_t index = job->next_index++;
+        auto request = Protocol::packFetchFileChunkRequest(job->client_id, job->message_id, index);
+
+        connection.submit(std::move(request), [this, job, index](bool ok, const ResponseHeader& header,
+                                                                 std::vector<uint8_t>& payload) {
+            if (job->failed) {
+                return;
+            }
+
+            std::string error;
+            if (!ok) {
+                error = "connection lost";
+            } else if (header.code != RES_FILE_CHUNK) {
+                error = "server could not return chunk " + std::to_string(index);
+            } else {
+                try {
+                    // Responses arrive in request order, so batches are appended in order
+                    job->batch.push_back(MessageUtils::parseFileChunk(payload, job->message_id, index, job->msg_type));
+                    if (job->batch.size() == job->cipher->batchSize() || index + 1 == job->chunk_count) {
+                        job->cipher->decrypt(job->batch, 0);
+                        for (const auto& chunk : job->batch) {
+                            size_t length = chunk.size() - AESWrapper::IV_SIZE;
+                            job->out.write(reinterpret_cast<const char*>(chunk.data() + AESWrapper::IV_SIZE), length);
+                            job->written += length;
+                        }
+                        job->batch.clear();
+                    }
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+            }
+
+            if (!error.empty()) {
+                job->failed = true;
+                job->out.close();
+                std::remove(job->path.c_str());
+                downloadFinished(job->message_id, false);
+                finishJob(job->job_id, false, error);
+                return;
+            }
+
+            job->received++;
+            updateJob(job->job_id, job->received, job->chunk_count);
+            if (job->received == job->chunk_count) {
+                job->out.close();
+                bool saved = static_cast<bool>(job->out);
+                downloadFinished(job->message_id, saved);
+                finishJob(job->job_id, saved, saved ? job->path + " (" + std::to_string(job->written) + " bytes)"
+                                                    : "could not write " + job->path);
+                return;
+            }
+            pumpDownload(job);
+        });
+    }
+}
+
+void BackgroundTasks::startPolling(const uint8_t* client_id, unsigned interval_seconds) {
+    std::vector<uint8_t> id(client_id, client_id + CLIENT_ID_SIZE);
+    unsigned interval_ms = (interval_seconds > 0 ? interval_seconds : 1) * 1000;
+
+    polling = true;
+    loop.post([this, id, interval_ms]() {
+        std::memcpy(poll_client_id, id.data(), CLIENT_ID_SIZE);
+        if (poll_timer >= 0) {
+            loop.cancelTimer(poll_timer);
+        }
+        poll_timer = loop.addTimer(interval_ms, [this]() { poll(); });
+    });
+}
+
+void BackgroundTasks::poll() {
+    // A slow server must not pile up polls behind each other
+    if (poll_in_flight) {
+        return;
+    }
+    poll_in_flight = true;
+
+    uint32_t after_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        after_id = poll_cursor;
+    }
+    // One page per poll; a longer backlog comes in over the next polls
+    auto request = Protocol::packMessagePageRequest(poll_client_id, after_id, MESSAGE_PAGE_MESSAGES,
+                                                    MESSAGE_PAGE_BYTES);
+
+    connection.submit(request, [this](bool ok, const ResponseHeader& header, std::vector<uint8_t>& payload) {
+        poll_in_flight = false;
+        acceptPage(ok, header, payload);
+    });
+}
+
+void BackgroundTasks::startReceiving(const uint8_t* client_id) {
+    std::vector<uint8_t> id(client_id, client_id + CLIENT_ID_SIZE);
+
+    polling = true;
+    loop.post([this, id]() {
+        std::memcpy(poll_client_id, id.data(), CLIENT_ID_SIZE);
+        receiving = true;
+        waitForMessages();
+    });
+}
+
+void BackgroundTasks::waitForMessages() {
+    if (!receiving || wait_in_flight) {
+        return;
+    }
+
+    uint32_t after_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Resumed by takeInbox() or acknowledged()
+        if (inboxFull()) {
+            return;
+        }
+        after_id = poll_cursor;
+    }
+    wait_in_flight = true;
+
+    auto request = Protocol::packWaitMessagesRequest(poll_client_id, after_id, MESSAGE_WAIT_MS,
+                                                     MESSAGE_PAGE_MESSAGES, MESSAGE_PAGE_BYTES);
+    wait_connection.submit(request, [this](bool ok, const ResponseHeader& header, std::vector<uint8_t>& payload) {
+        wait_in_flight = false;
+        if (ok && header.code == RES_GENERAL_ERROR) {
+            // An older server without REQ_WAIT_MESSAGES; asking again can't help
+            receiving = false;
+            notice("The server can't hold wait requests; checking for new messages every " +
+                   std::to_string(MESSAGE_WAIT_FALLBACK_POLL_MS / 1000) + " s instead");
+            if (poll_timer < 0) {
+                poll_timer = loop.addTimer(MESSAGE_WAIT_FALLBACK_POLL_MS, [this]() { poll(); });
+            }
+            return;
+        }
+        if (!acceptPage(ok, header, payload)) {
+            // Asking again straight away would spin while the server is down
+            if (receiving && wait_retry_timer < 0) {
+                wait_retry_timer = loop.addTimer(MESSAGE_WAIT_RETRY_MS, [this]() { waitForMessages(); });
+            }
+            return;
+        }
+
+        if (wait_retry_timer >= 0) {
+            loop.cancelTimer(wait_retry_timer);
+            wait_retry_timer = -1;
+        }
+        // Messages or a timeout; either way the next wait starts at once
+        waitForMessages();
+    });
+}
+
+bool BackgroundTasks::acceptPage(bool ok, const ResponseHeader& header, std::vector<uint8_t>& payload) {
+    if (!ok || header.code != RES_MESSAGE_PAGE) {
+        return false;
+    }
+
+    std::vector<Message> messages;
+    bool more = false;
+    try {
+        messages = MessageUtils::parseMessagePage(payload, &more);
+    } catch (const std::exception& e) {
+        notice(std::string("Could not parse polled messages: ") + e.what());
+        return false;
+    }
+
+    size_t waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t before = inbox.size();
+        // A fetch may have shown and acknowledged some of these while the request was out
+        for (auto& msg : messages) {
+            if (msg.id > poll_cursor) {
+                poll_cursor = msg.id;
+                inbox.push_back(std::move(msg));
+            }
+        }
+        if (inbox.size() == before) {
+            return true;
+        }
+        waiting = inbox.size();
+    }
+    notice(std::to_string(waiting) + " new message(s) - choose 140 to read");
+    return true;
+}
+
+bool BackgroundTasks::inboxFull() const {
+    if (inbox.size() >= MESSAGE_PAGE_MESSAGES) {
+        return true;
+    }
+    size_t bytes = 0;
+    for (const auto& msg : inbox) {
+        bytes += msg.content.size();
+    }
+    return bytes >= MESSAGE_PAGE_BYTES;
+}
+
+std::vector<Message> BackgroundTasks::takeInbox() {
+    std::vector<Message> messages;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        messages.swap(inbox);
+    }
+    // Room again if receiving had paused
+    loop.post([this]() { waitForMessages(); });
+    return messages;
+}
+
+void BackgroundTasks::acknowledged(uint32_t through_id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (through_id > poll_cursor) {
+        poll_cursor = through_id;
+    }
+    inbox.erase(std::remove_if(inbox.begin(), inbox.end(),
+                               [through_id](const Message& msg) { return msg.id <= through_id; }),
+                inbox.end());
+    loop.post([this]() { waitForMessages(); });
+}
+
+void BackgroundTasks::acknowledge(const uint8_t* client_id, uint32_t through_id) {
+    std::vector<uint8_t> id(client_id, client_id + CLIENT_ID_SIZE);
+    loop.post([this, id, through_id]() {
+        std::memcpy(ack_client_id, id.data(), CLIENT_ID_SIZE);
+        ack_wanted = std::max(ack_wanted, through_id);
+        sendAcknowledgement();
+    });
+}
+
+void BackgroundTasks::downloadFinished(uint32_t message_id, bool ok) {
+    downloading.erase(message_id);
+    if (!ok && (failed_download == 0 || message_id < failed_download)) {
+        failed_download = message_id;
+    }
+    sendAcknowledgement();
+}
+
+void BackgroundTasks::sendAcknowledgement() {
+    uint32_t through_id = ack_wanted;
+    if (!downloading.empty()) {
+        through_id = std::min(through_id, *downloading.begin() - 1);
+    }
+    if (failed_download != 0) {
+        through_id = std::min(through_id, failed_download - 1);
+    }
+    if (through_id <= ack_sent) {
+        return;
+    }
+
+    uint32_t previous = ack_sent;
+    ack_sent = through_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        acks_in_flight++;
+    }
+    auto request = Protocol::packAckMessagesRequest(ack_client_id, through_id);
+    connection.submit(request, [this, previous, through_id](bool ok, const ResponseHeader& header,
+                                                            std::vector<uint8_t>&) {
+        // Left for the next acknowledgement, or delivered again next session
+        if ((!ok || header.code != RES_MESSAGES_ACKED) && ack_sent == through_id) {
+            ack_sent = previous;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            acks_in_flight--;
+        }
+        idle.notify_all();
+    });
+}
+
+std::map<uint32_t, BackgroundTasks::JobStatus> BackgroundTasks::jobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return statuses;
+}
+
+size_t BackgroundTasks::activeJobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return active;
+}
+
+void BackgroundTasks::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return active == 0 && acks_in_flight == 0; });
+}
+
+uint32_t BackgroundTasks::addJob(const std::string& description) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t job_id = next_job_id++;
+    statuses[job_id] = JobStatus{description, 0, 0, JobState::Running, std::string()};
+    active++;
+    return job_id;
+}
+
+void BackgroundTasks::updateJob(uint32_t job_id, uint32_t chunks_done, uint32_t chunk_count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    JobStatus& status = statuses[job_id];
+    status.chunks_done = chunks_done;
+    status.chunk_count = chunk_count;
+}
+
+void BackgroundTasks::finishJob(uint32_t job_id, bool ok, const std::string& detail) {
+    std::string description;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        JobStatus& status = statuses[job_id];
+        status.state = ok ? JobState::Done : JobState::Failed;
+        status.detail = detail;
+        description = status.description;
+        active--;
+    }
+    idle.notify_all();
+    notice((ok ? "Finished " : "Failed ") + description + ": " + detail);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+// With --csv every benchmark prints one row instead of an aligned line:
+//
+//   name,iterations,ns_per_op,mb_per_s
+//
+// mb_per_s is empty when the benchmark has no byte count. Commentary such as
+// speedup ratios goes to stderr in that mode, so `make -s bench BENCH_ARGS=--csv`
+// yields a file that bench/compare.py can diff against an earlier run.
+inline bool& benchCsv() {
+    static bool csv = false;
+    return csv;
+}
+
+inline void benchInit(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--csv") == 0) {
+            benchCsv() = true;
+        }
+    }
+}
+
+inline std::ostream& benchNote() {
+    return benchCsv() ? std::cerr : std::cout;
+}
+
+// Minimal timing harness: runs fn `iterations` times after a short warm-up
+// and prints the mean cost per operation, plus throughput when each call
+// processes bytes_per_op bytes.
+template <typename Fn>
+double runBenchmark(const std::string& name, uint64_t iterations, Fn fn, uint64_t bytes_per_op = 0) {
+    for (uint64_t i = 0; i < iterations / 10 + 1; i++) {
+        fn();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    double mb_per_s = bytes_per_op ? bytes_per_op * 1000.0 / ns_per_op : 0;
+
+    if (benchCsv()) {
+        std::cout << name << "," << iterations << "," << std::fixed << std::setprecision(1) << ns_per_op << ",";
+        if (bytes_per_op) {
+            std::cout << mb_per_s;
+        }
+        std::cout << std::endl;
+        return ns_per_op;
+    }
+
+    std::cout << std::left << std::setw(40) << name
+              << std::right << std::setw(14) << std::fixed << std::setprecision(1)
+              << ns_per_op << " ns/op";
+    if (bytes_per_op) {
+        std::cout << std::setw(12) << mb_per_s << " MB/s";
+    }
+    std::cout << std::endl;
+    return ns_per_op;
+}
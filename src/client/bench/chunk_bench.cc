@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "chunk_cipher.h"
+#include "worker_pool.h"
+#include "protocol.h"
+#include "crypto/AESWrapper.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Encrypting a 32 MiB file: one CBC stream on one thread against
+// FILE_CHUNK_SIZE chunks with their own IVs spread over 1, 2, 4, ... threads
+// up to the core count. Decryption takes the same path through ChunkCipher.
+int main(int argc, char* argv[]) {
+    benchInit(argc, argv);
+
+    const size_t file_size = 32 * 1024 * 1024;
+    const size_t chunk_count = file_size / FILE_CHUNK_SIZE;
+    const uint64_t iterations = 5;
+    auto key = AESWrapper::generateKey();
+    volatile size_t sink = 0;
+
+    std::vector<uint8_t> file(file_size);
+    for (size_t i = 0; i < file_size; i++) {
+        file[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    AESWrapper aes(key);
+    std::vector<uint8_t> whole(AESWrapper::ciphertextSize(file_size));
+    double single = runBenchmark("file_encrypt/whole_cbc", iterations, [&]() {
+        sink = sink + aes.encrypt(file.data(), file.size(), whole.data());
+    }, file_size);
+
+    size_t cores = WorkerPool::defaultThreads();
+    for (size_t threads = 1; ; threads = std::min(threads * 2, cores)) {
+        WorkerPool pool(threads);
+        ChunkCipher cipher(pool, key, false);
+
+        // Batched the way sendFileChunks reads them
+        std::vector<std::vector<std::vector<uint8_t>>> batches;
+        for (size_t c = 0; c < chunk_count; c++) {
+            if (c % cipher.batchSize() == 0) {
+                batches.emplace_back();
+            }
+            batches.back().emplace_back();
+            batches.back().back().reserve(AESWrapper::framedSize(FILE_CHUNK_SIZE));
+        }
+
+        // The chunks are re-read each time, as a send would
+        double ns = runBenchmark("file_encrypt/chunked_" + std::to_string(threads) + "t", iterations, [&]() {
+            const uint8_t* next = file.data();
+            for (auto& batch : batches) {
+                for (auto& chunk : batch) {
+                    chunk.resize(AESWrapper::IV_SIZE + FILE_CHUNK_SIZE);
+                    std::memcpy(chunk.data() + AESWrapper::IV_SIZE, next, FILE_CHUNK_SIZE);
+                    next += FILE_CHUNK_SIZE;
+                }
+                cipher.encrypt(batch, 0);
+            }
+            sink = sink + batches.back().back().size();
+        }, file_size);
+
+        benchNote() << "  " << threads << " threads: " << single / ns << "x whole-file CBC" << std::endl;
+        if (threads == cores) {
+            break;
+        }
+    }
+
+    return 0;
+}
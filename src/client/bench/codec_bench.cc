@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "message.h"
+#include "protocol.h"
+#include "crypto/Base64Wrapper.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Framing and encoding helpers that run on every request: header packing,
+// message request packing, hex IDs (peers.info, directory keys) and base64
+// keys (my.info).
+int main(int argc, char* argv[]) {
+    benchInit(argc, argv);
+
+    uint8_t from_id[CLIENT_ID_SIZE];
+    uint8_t to_id[CLIENT_ID_SIZE];
+    std::memset(from_id, 0xA5, sizeof(from_id));
+    std::memset(to_id, 0x5A, sizeof(to_id));
+    volatile size_t sink = 0;
+
+    runBenchmark("packRequestHeader", 1000000, [&]() {
+        auto header = Protocol::packRequestHeader(from_id, REQ_SEND_MESSAGE, 1024);
+        sink = sink + header.size();
+    });
+    uint8_t header_buffer[HEADER_SIZE];
+    runBenchmark("writeRequestHeader", 1000000, [&]() {
+        Protocol::writeRequestHeader(header_buffer, from_id, REQ_SEND_MESSAGE, 1024);
+        sink = sink + header_buffer[HEADER_SIZE - 1];
+    });
+
+    for (size_t size : {64, 4096, 65536}) {
+        std::vector<uint8_t> content(size, 'm');
+        runBenchmark("packSendMessageRequest/" + std::to_string(size) + "B", 2000000 / (size / 64 + 8), [&]() {
+            auto request = Protocol::packSendMessageRequest(from_id, to_id, MSG_TYPE_TEXT_MESSAGE, content);
+            sink = sink + request.size();
+        }, size);
+    }
+    uint8_t prefix[SEND_MESSAGE_PREFIX_SIZE];
+    runBenchmark("packSendMessagePrefix", 1000000, [&]() {
+        Protocol::packSendMessagePrefix(prefix, from_id, to_id, MSG_TYPE_TEXT_MESSAGE, 4096);
+        sink = sink + prefix[0];
+    });
+
+    std::string hex;
+    runBenchmark("bytesToHex/16B", 1000000, [&]() {
+        hex = MessageUtils::bytesToHex(from_id, CLIENT_ID_SIZE);
+        sink = sink + hex.size();
+    }, CLIENT_ID_SIZE);
+    uint8_t decoded_id[CLIENT_ID_SIZE];
+    runBenchmark("hexToBytes/16B", 1000000, [&]() {
+        MessageUtils::hexToBytes(hex, decoded_id, CLIENT_ID_SIZE);
+        sink = sink + decoded_id[0];
+    }, CLIENT_ID_SIZE);
+
+    for (size_t size : {160, 4096, 65536}) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = static_cast<uint8_t>(i * 31);
+        }
+        const std::string encoded = Base64Wrapper::encode(data);
+        uint64_t iterations = 4000000 / (size + 256);
+
+        runBenchmark("base64_encode/" + std::to_string(size) + "B", iterations, [&]() {
+            sink = sink + Base64Wrapper::encode(data).size();
+        }, size);
+        runBenchmark("base64_decode/" + std::to_string(size) + "B", iterations, [&]() {
+            sink = sink + Base64Wrapper::decode(encoded).size();
+        }, size);
+    }
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""
+Compares two benchmark runs saved with `make -s bench BENCH_ARGS=--csv > run.csv`.
+
+    python3 bench/compare.py baseline.csv current.csv [--threshold PERCENT]
+
+Prints every benchmark present in both runs with its change in ns/op and
+exits with status 1 if any got slower by more than the threshold (default 10%).
+"""
+
+import sys
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split(',')
+            if len(fields) != 4:
+                continue
+            try:
+                results[fields[0]] = float(fields[2])
+            except ValueError:
+                continue
+    return results
+
+
+def main():
+    args = sys.argv[1:]
+    threshold = 10.0
+    if '--threshold' in args:
+        index = args.index('--threshold')
+        threshold = float(args[index + 1])
+        del args[index:index + 2]
+    if len(args) != 2:
+        print(__doc__.strip())
+        return 2
+
+    baseline = load(args[0])
+    current = load(args[1])
+
+    regressions = 0
+    print(f"{'benchmark':<40}{'base ns/op':>14}{'new ns/op':>14}{'change':>10}")
+    for name, base_ns in baseline.items():
+        if name not in current:
+            continue
+        new_ns = current[name]
+        change = (new_ns - base_ns) / base_ns * 100 if base_ns else 0.0
+        flag = ''
+        if change > threshold:
+            flag = '  REGRESSION'
+            regressions += 1
+        print(f"{name:<40}{base_ns:>14.1f}{new_ns:>14.1f}{change:>+9.1f}%{flag}")
+
+    missing = sorted(set(baseline) ^ set(current))
+    if missing:
+        print(f"\nOnly in one run: {', '.join(missing)}")
+
+    if regressions:
+        print(f"\n{regressions} benchmark(s) slower by more than {threshold:g}%")
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
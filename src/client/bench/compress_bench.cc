@@ -0,0 +1,147 @@
+#include "bench.h"
+#include "compression.h"
+#include "chunk_cipher.h"
+#include "worker_pool.h"
+#include "protocol.h"
+#include "crypto/AESWrapper.h"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// Bytes on the wire and CPU per message for encrypt-only against
+// compress-then-encrypt, on content that compresses well (JSON, log lines)
+// and content that doesn't (random bytes, where compress() gives up and the
+// cost is the wasted attempt). Then the same for a chunked file, whose
+// FILE_CHUNK_SIZE chunks are compressed one by one on ChunkCipher's lanes.
+// Build with COMPRESS=zlib|zstd|lz4; without a codec both paths are the same.
+static std::vector<uint8_t> repeated(const std::string& record, size_t size) {
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    for (size_t i = 0; data.size() < size; i++) {
+        std::string line = record;
+        size_t at = line.find("%d");
+        if (at != std::string::npos) {
+            line.replace(at, 2, std::to_string(i));
+        }
+        data.insert(data.end(), line.begin(), line.end());
+    }
+    data.resize(size);
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    benchInit(argc, argv);
+
+    std::mt19937 rng(7);
+    std::vector<uint8_t> random(64 * 1024);
+    for (auto& byte : random) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    struct Sample {
+        const char* name;
+        std::vector<uint8_t> data;
+    };
+    std::vector<Sample> samples = {
+        {"json_4k", repeated("{\"id\":%d,\"user\":\"alice\",\"status\":\"delivered\",\"tags\":[\"inbox\"]},", 4096)},
+        {"log_64k", repeated("2024-05-01T12:00:00Z INFO server: request %d handled in 3ms\n", 64 * 1024)},
+        {"random_64k", random},
+    };
+
+    benchNote() << "codec: " << compression::codecName(compression::builtIn()) << std::endl;
+
+    AESWrapper aes;
+    volatile size_t sink = 0;
+    for (const auto& sample : samples) {
+        const size_t size = sample.data.size();
+        const uint64_t iterations = 2000;
+        std::vector<uint8_t> ciphertext(AESWrapper::ciphertextSize(size));
+
+        runBenchmark(std::string("encrypt/") + sample.name, iterations, [&]() {
+            sink = sink + aes.encrypt(sample.data.data(), size, ciphertext.data());
+        }, size);
+
+        std::vector<uint8_t> wire;
+        runBenchmark(std::string("compress_encrypt/") + sample.name, iterations, [&]() {
+            uint8_t type = MSG_TYPE_TEXT_MESSAGE;
+            wire = compression::encryptContent(aes, type, sample.data.data(), size);
+            sink = sink + wire.size();
+        }, size);
+
+        uint8_t type = MSG_TYPE_TEXT_MESSAGE;
+        wire = compression::encryptContent(aes, type, sample.data.data(), size);
+        runBenchmark(std::string("decrypt_decompress/") + sample.name, iterations, [&]() {
+            sink = sink + compression::decryptContent(aes, type, wire).size();
+        }, size);
+
+        benchNote() << "  " << sample.name << ": " << ciphertext.size() << " -> " << wire.size()
+                    << " bytes on the wire" << std::endl;
+    }
+
+    const size_t file_size = 8 * 1024 * 1024;
+    const size_t chunk_count = file_size / FILE_CHUNK_SIZE;
+    std::vector<Sample> files = {
+        {"log_8m", repeated("2024-05-01T12:00:00Z INFO server: request %d handled in 3ms\n", file_size)},
+        {"random_8m", std::vector<uint8_t>(file_size)},
+    };
+    for (auto& byte : files[1].data) {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    WorkerPool pool(WorkerPool::defaultThreads());
+    auto key = AESWrapper::generateKey();
+    for (const auto& file : files) {
+        for (bool compressed : {false, true}) {
+            ChunkCipher cipher(pool, key, compressed);
+            std::string name = std::string(compressed ? "chunked_compress_encrypt/" : "chunked_encrypt/") + file.name;
+
+            // Batched the way sendFileChunks reads them
+            std::vector<std::vector<std::vector<uint8_t>>> batches;
+            for (size_t c = 0; c < chunk_count; c++) {
+                if (c % cipher.batchSize() == 0) {
+                    batches.emplace_back();
+                }
+                batches.back().emplace_back();
+            }
+
+            auto encrypt_all = [&]() {
+                const uint8_t* next = file.data.data();
+                for (auto& batch : batches) {
+                    for (auto& chunk : batch) {
+                        chunk.resize(AESWrapper::IV_SIZE + FILE_CHUNK_SIZE);
+                        std::memcpy(chunk.data() + AESWrapper::IV_SIZE, next, FILE_CHUNK_SIZE);
+                        next += FILE_CHUNK_SIZE;
+                    }
+                    cipher.encrypt(batch, 0);
+                }
+            };
+            runBenchmark(name, 20, [&]() {
+                encrypt_all();
+                sink = sink + batches.back().back().size();
+            }, file_size);
+
+            encrypt_all();
+            size_t wire = 0;
+            for (const auto& batch : batches) {
+                for (const auto& chunk : batch) {
+                    wire += chunk.size();
+                }
+            }
+            auto encrypted = batches;
+            runBenchmark(std::string(compressed ? "chunked_decrypt_decompress/" : "chunked_decrypt/") + file.name,
+                         20, [&]() {
+                batches = encrypted;
+                for (auto& batch : batches) {
+                    cipher.decrypt(batch, 0);
+                }
+                sink = sink + batches.back().back().size();
+            }, file_size);
+
+            benchNote() << "  " << name << ": " << file_size << " -> " << wire << " bytes on the wire" << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "bench.h"
+#include "keystore.h"
+#include "message.h"
+#include "crypto/AESWrapper.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Per-message symmetric key lookup: the hex-string std::map the client used
+// to keep against SymmetricKeyStore, for a mailbox cycling over many peers.
+int main(int argc, char* argv[]) {
+    benchInit(argc, argv);
+
+    const size_t peers = 1000;
+    std::mt19937 random(42);
+    std::vector<std::vector<uint8_t>> ids(peers, std::vector<uint8_t>(CLIENT_ID_SIZE));
+    std::map<std::string, std::vector<uint8_t>> by_hex;
+    SymmetricKeyStore store;
+
+    for (auto& id : ids) {
+        for (auto& byte : id) {
+            byte = static_cast<uint8_t>(random());
+        }
+        auto key = AESWrapper::generateKey();
+        by_hex[MessageUtils::clientIdToString(id.data())] = key;
+        store.put(id.data(), key);
+    }
+
+    volatile size_t sink = 0;
+    size_t next = 0;
+
+    double map_lookup = runBenchmark("symkey_lookup/hex_map", 200000, [&]() {
+        const auto& id = ids[next++ % peers];
+        std::string id_str = MessageUtils::clientIdToString(id.data());
+        if (by_hex.count(id_str) > 0) {
+            std::vector<uint8_t> key = by_hex[id_str];
+            sink = sink + key[0];
+        }
+    });
+    double store_lookup = runBenchmark("symkey_lookup/keystore", 200000, [&]() {
+        const uint8_t* key = store.find(ids[next++ % peers].data());
+        sink = sink + (key ? key[0] : 0);
+    });
+
+    double map_cipher = runBenchmark("symkey_cipher/hex_map", 200000, [&]() {
+        const auto& id = ids[next++ % peers];
+        AESWrapper aes(by_hex[MessageUtils::clientIdToString(id.data())]);
+        sink = sink + aes.getKey().size();
+    });
+    double store_cipher = runBenchmark("symkey_cipher/keystore", 200000, [&]() {
+        AESWrapper* aes = store.cipher(ids[next++ % peers].data());
+        sink = sink + aes->getKey().size();
+    });
+
+    benchNote() << "lookup speedup: " << map_lookup / store_lookup << "x" << std::endl;
+    benchNote() << "cipher speedup: " << map_cipher / store_cipher << "x" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "bench.h"
+#include "message.h"
+#include "protocol.h"
+
+#include <cstring>
+#include <iostream>
+
+// Compares the copying parsers against the zero-copy views on synthetic
+// payloads laid out exactly as the server sends them.
+static std::vector<uint8_t> makeMailbox(size_t count, size_t content_size) {
+    std::vector<uint8_t> payload;
+    for (size_t i = 0; i < count; i++) {
+        payload.insert(payload.end(), CLIENT_ID_SIZE, static_cast<uint8_t>(i));
+        uint32_t id = static_cast<uint32_t>(i);
+        uint32_t size = static_cast<uint32_t>(content_size);
+        for (int b = 0; b < 4; b++) payload.push_back((id >> (8 * b)) & 0xFF);
+        payload.push_back(MSG_TYPE_TEXT_MESSAGE);
+        for (int b = 0; b < 4; b++) payload.push_back((size >> (8 * b)) & 0xFF);
+        payload.insert(payload.end(), content_size, 'x');
+    }
+    return payload;
+}
+
+static std::vector<uint8_t> makeClientList(size_t count) {
+    std::vector<uint8_t> payload(count * (CLIENT_ID_SIZE + USERNAME_MAX_SIZE), 0);
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* entry = payload.data() + i * (CLIENT_ID_SIZE + USERNAME_MAX_SIZE);
+        std::memset(entry, static_cast<int>(i), CLIENT_ID_SIZE);
+        std::string name = "user" + std::to_string(i);
+        std::memcpy(entry + CLIENT_ID_SIZE, name.c_str(), name.size());
+    }
+    return payload;
+}
+
+int main(int argc, char* argv[]) {
+    benchInit(argc, argv);
+    
+    const auto mailbox = makeMailbox(1000, 256);
+    const auto clients = makeClientList(1000);
+    volatile size_t sink = 0;
+    
+    double parse_messages = runBenchmark("parseMessages/1000x256B", 200, [&]() {
+        auto messages = MessageUtils::parseMessages(mailbox);
+        sink = sink + messages.size();
+    });
+    double view_messages = runBenchmark("viewMessages/1000x256B", 200, [&]() {
+        size_t total = 0;
+        for (const auto& msg : MessageUtils::viewMessages(mailbox)) {
+            total += msg.content_size;
+        }
+        sink = sink + total;
+    });
+    
+    double parse_clients = runBenchmark("parseClientList/1000", 200, [&]() {
+        auto list = MessageUtils::parseClientList(clients);
+        sink = sink + list.size();
+    });
+    double view_clients = runBenchmark("viewClientList/1000", 200, [&]() {
+        size_t total = 0;
+        for (const auto& client : MessageUtils::viewClientList(clients)) {
+            total += client.name_length;
+        }
+        sink = sink + total;
+    });
+    
+    benchNote() << "messages speedup: " << parse_messages / view_messages << "x" << std::endl;
+    benchNote() << "client list speedup: " << parse_clients / view_clients << "x" << std::endl;
+    
+    return 0;
+}
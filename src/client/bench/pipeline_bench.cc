@@ -0,0 +1,102 @@
+#include "connection.h"
+#include "pipeline.h"
+#include "protocol.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+typedef std::chrono::steady_clock Clock;
+
+// Runs `count` copies of one request through a pipeline of the given window
+// and prints throughput and the mean time from submit to response
+static void runPipelined(Connection& connection, const std::string& name, size_t window, size_t count,
+                         const uint8_t* prefix, size_t prefix_size, const std::vector<uint8_t>& content) {
+    std::deque<Clock::time_point> submitted;
+    double latency_total_us = 0;
+
+    RequestPipeline pipeline(connection, window);
+    auto start = Clock::now();
+    for (size_t i = 0; i < count; i++) {
+        submitted.push_back(Clock::now());
+        pipeline.submit(prefix, prefix_size, content, [&](const ResponseHeader&, std::vector<uint8_t>&) {
+            latency_total_us += std::chrono::duration<double, std::micro>(Clock::now() - submitted.front()).count();
+            submitted.pop_front();
+        });
+    }
+    pipeline.drain();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::string label = name + "/window=" + std::to_string(window);
+    std::cout << std::left << std::setw(40) << label
+              << std::right << std::setw(14) << std::fixed << std::setprecision(1)
+              << count / seconds << " req/s"
+              << std::setw(12) << latency_total_us / count << " us latency"
+              << (pipeline.errors() ? "  (errors: " + std::to_string(pipeline.errors()) + ")" : "")
+              << std::endl;
+}
+
+// Sends the same request stream with growing pipeline windows against a
+// running server. Window 1 is the old send-then-wait behaviour. Two request
+// kinds are measured: an incremental client list past the newest client (a
+// read-only query, so round trips dominate) and a message send (dominated by
+// the server's database commit).
+//
+//   bench_pipeline [host] [port] [requests]
+int main(int argc, char* argv[]) {
+    std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? std::atoi(argv[2]) : 1357;
+    size_t requests = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2000;
+
+    Connection connection;
+    connection.setQuiet(true);
+    connection.setEndpoint(host, port);
+    if (!connection.acquire()) {
+        std::cerr << "Could not connect to " << host << ":" << port << std::endl;
+        return 1;
+    }
+
+    // A throwaway client to send to itself; the server doesn't check the key
+    std::random_device random;
+    std::string name = "bench" + std::to_string(random());
+    auto request = Protocol::packRegisterRequest(name, std::vector<uint8_t>(PUBLIC_KEY_SIZE, 0));
+    uint8_t client_id[CLIENT_ID_SIZE];
+    {
+        RequestPipeline pipeline(connection, 1);
+        bool registered = false;
+        pipeline.submit(request, [&](const ResponseHeader& header, std::vector<uint8_t>& payload) {
+            if (header.code == RES_REGISTRATION_SUCCESS && payload.size() >= CLIENT_ID_SIZE) {
+                std::memcpy(client_id, payload.data(), CLIENT_ID_SIZE);
+                registered = true;
+            }
+        });
+        pipeline.drain();
+        if (!registered) {
+            std::cerr << "Registration failed" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << requests << " requests per run against " << host << ":" << port << std::endl;
+    const size_t windows[] = {1, 2, 4, 8, 16, 32, 64};
+
+    auto list_request = Protocol::packClientListSinceRequest(client_id, UINT32_MAX);
+    for (size_t window : windows) {
+        runPipelined(connection, "list-since", window, requests,
+                     list_request.data(), list_request.size(), std::vector<uint8_t>());
+    }
+
+    std::vector<uint8_t> content(64, 'x');
+    uint8_t prefix[SEND_MESSAGE_PREFIX_SIZE];
+    Protocol::packSendMessagePrefix(prefix, client_id, client_id, MSG_TYPE_TEXT_MESSAGE, content.size());
+    for (size_t window : windows) {
+        runPipelined(connection, "send-64B", window, requests / 4, prefix, sizeof(prefix), content);
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "chunk_cipher.h"
+#include "worker_pool.h"
+#include "compression.h"
+#include "crypto/AESWrapper.h"
+
+#include <algorithm>
+#include <future>
+
+ChunkCipher::ChunkCipher(WorkerPool& pool, const std::vector<uint8_t>& key, bool compressed)
+    : pool(pool), compressed(compressed) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        lanes.emplace_back(new AESWrapper(key));
+    }
+}
+
+ChunkCipher::~ChunkCipher() = default;
+
+void ChunkCipher::encrypt(std::vector<std::vector<uint8_t>>& chunks, size_t offset) {
+    run(chunks, offset, true);
+}
+
+void ChunkCipher::decrypt(std::vector<std::vector<uint8_t>>& chunks, size_t offset) {
+    run(chunks, offset, false);
+}
+
+void ChunkCipher::run(std::vector<std::vector<uint8_t>>& chunks, size_t offset, bool encrypting) {
+    size_t lane_count = std::min(lanes.size(), chunks.size());
+
+    auto process = [this, &chunks, offset, encrypting, lane_count](AESWrapper& aes, size_t first) {
+        for (size_t i = first; i < chunks.size(); i += lane_count) {
+            std::vector<uint8_t>& chunk = chunks[i];
+            if (encrypting) {
+                if (compressed) {
+                    compression::frameChunk(chunk, offset + AESWrapper::IV_SIZE);
+                }
+                size_t length = chunk.size() - offset - AESWrapper::IV_SIZE;
+                chunk.resize(offset + AESWrapper::framedSize(length));
+                aes.encryptFramed(chunk.data() + offset, length);
+            } else {
+                size_t length = aes.decryptFramed(chunk.data() + offset, chunk.size() - offset);
+                chunk.resize(offset + AESWrapper::IV_SIZE + length);
+                if (compressed) {
+                    compression::unframeChunk(chunk, offset + AESWrapper::IV_SIZE);
+                }
+            }
+        }
+    };
+
+    // Not worth a hand-off to the pool
+    if (lane_count <= 1) {
+        if (lane_count == 1) {
+            process(*lanes[0], 0);
+        }
+        return;
+    }
+
+    std::vector<std::future<void>> done;
+    done.reserve(lane_count);
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        AESWrapper* aes = lanes[lane].get();
+        done.push_back(pool.submit([&process, aes, lane]() { process(*aes, lane); }));
+    }
+    // Every lane has to finish before chunks goes out of scope, even if one failed
+    for (auto& lane : done) {
+        lane.wait();
+    }
+    for (auto& lane : done) {
+        lane.get();
+    }
+}
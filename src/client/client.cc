@@ -1,21 +1,50 @@
 #include "client.h"
 #include "protocol.h"
 #include "message.h"
+#include "mailbox.h"
+#include "pipeline.h"
+#include "background.h"
+#include "script.h"
+#include "worker_pool.h"
+#include "chunk_cipher.h"
+#include "compression.h"
+#include "instrument.h"
 #include "crypto/RSAPrivateWrapper.h"
 #include "crypto/RSAPublicWrapper.h"
 #include "crypto/AESWrapper.h"
 #include "crypto/Base64Wrapper.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <cstring>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include <deque>
+#include <future>
+#include <random>
+#include <unordered_map>
 
-MessageUClient::MessageUClient() : sock(-1), rsa_private(nullptr), registered(false) {
+std::string MessageUClient::receivedFilePath(uint32_t message_id) {
+    // Cross-platform temp directory resolution (Windows/Unix)
+    const char* tmp_dir = std::getenv("TMP");
+    if (!tmp_dir) {
+        tmp_dir = std::getenv("TEMP");
+    }
+    if (!tmp_dir) {
+        tmp_dir = "/tmp";
+    }
+    
+    return std::string(tmp_dir) + "/received_" + std::to_string(message_id) + ".bin";
+}
+
+MessageUClient::MessageUClient(bool persistent)
+    : session(connections.checkout()), connection(*session), rsa_private(nullptr), registered(false),
+      persistent(persistent), crypto_threads(0), poll_interval(0), push_receive(false),
+      shown_through(0) {
     std::memset(client_id, 0, CLIENT_ID_SIZE);
     loadServerInfo();
+    connections.setEndpoint(server_ip, server_port);
 }
 
 MessageUClient::~MessageUClient() {
@@ -43,8 +72,6 @@ void MessageUClient::loadServerInfo() {
         }
     }
     file.close();
-    
-    std::cout << "Server: " << server_ip << ":" << server_port << std::endl;
 }
 
 bool MessageUClient::loadMyInfo() {
@@ -73,6 +100,7 @@ bool MessageUClient::loadMyInfo() {
     auto private_key = Base64Wrapper::decode(private_key_b64);
     rsa_private = new RSAPrivateWrapper(private_key);
     registered = true;
+    symmetric_keys.attach(SYMMETRIC_KEYS_FILE, *rsa_private, false);
     
     file.close();
     return true;
@@ -95,71 +123,172 @@ void MessageUClient::saveMyInfo() {
 }
 
 bool MessageUClient::connect() {
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        std::cerr << "Failed to create socket" << std::endl;
-        return false;
-    }
-    
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
-    
-    if (inet_pton(AF_INET, server_ip.c_str(), &server_addr.sin_addr) <= 0) {
-        std::cerr << "Invalid address" << std::endl;
-        return false;
-    }
-    
-    if (::connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "Connection failed" << std::endl;
-        return false;
-    }
-    
-    std::cout << "Connected to server" << std::endl;
-    return true;
+    return connection.acquire();
 }
 
 void MessageUClient::disconnect() {
-    if (sock >= 0) {
-        close(sock);
-        sock = -1;
+    connection.close();
+}
+
+void MessageUClient::releaseConnection() {
+    if (!persistent) {
+        connection.close();
     }
 }
 
 bool MessageUClient::sendRequest(const std::vector<uint8_t>& request) {
-    ssize_t sent = send(sock, request.data(), request.size(), 0);
-    return sent == static_cast<ssize_t>(request.size());
+    return sendRequest(request.data(), request.size(), std::vector<uint8_t>());
 }
 
-std::vector<uint8_t> MessageUClient::receiveResponse() {
+bool MessageUClient::sendRequest(const uint8_t* prefix, size_t prefix_size,
+                                 const std::vector<uint8_t>& content) {
+    if (connection.sendGather(prefix, prefix_size, content.data(), content.size())) {
+        return true;
+    }
+    
+    // The server may have dropped an idle socket between the liveness check and
+    // the write; nothing was processed, so it is safe to resend on a fresh one
+    connection.close();
+    if (!connection.acquire()) {
+        return false;
+    }
+    return connection.sendGather(prefix, prefix_size, content.data(), content.size());
+}
+
+bool MessageUClient::sendMessageRequest(const uint8_t* target_id, uint8_t msg_type,
+                                        const std::vector<uint8_t>& content) {
+    uint8_t prefix[SEND_MESSAGE_PREFIX_SIZE];
+    Protocol::packSendMessagePrefix(prefix, client_id, target_id, msg_type, content.size());
+    return sendRequest(prefix, sizeof(prefix), content);
+}
+
+ResponseHeader MessageUClient::receiveResponseHeader() {
     std::vector<uint8_t> header(7);
-    // MSG_WAITALL blocks until all 7 bytes arrive or connection closes
-    ssize_t received = recv(sock, header.data(), 7, MSG_WAITALL);
-    if (received != 7) {
-        throw std::runtime_error("Failed to receive response header");
+    {
+        // From the end of the send until the first bytes of the answer
+        INSTRUMENT_TIMER(timer, instrument::PHASE_SERVER_WAIT);
+        if (!connection.recvAll(header.data(), header.size())) {
+            // Stream position is unknown after a short read; the socket can't be reused
+            connection.close();
+            throw std::runtime_error("Failed to receive response header");
+        }
     }
     
     auto resp_header = Protocol::unpackResponseHeader(header);
     
+    if (resp_header.code == RES_GENERAL_ERROR) {
+        // Consume the (normally empty) error payload so the connection stays usable
+        std::vector<uint8_t> payload(resp_header.payload_size);
+        if (!payload.empty() && !connection.recvAll(payload.data(), payload.size())) {
+            connection.close();
+        }
+        throw std::runtime_error("Server responded with an error");
+    }
+    
+    return resp_header;
+}
+
+std::vector<uint8_t> MessageUClient::receiveResponse() {
+    auto resp_header = receiveResponseHeader();
+    
     std::vector<uint8_t> payload(resp_header.payload_size);
     if (resp_header.payload_size > 0) {
-        received = recv(sock, payload.data(), resp_header.payload_size, MSG_WAITALL);
-        if (received != static_cast<ssize_t>(resp_header.payload_size)) {
+        INSTRUMENT_TIMER(timer, instrument::PHASE_RECEIVE);
+        INSTRUMENT_ADD_BYTES(timer, payload.size());
+        if (!connection.recvAll(payload.data(), payload.size())) {
+            connection.close();
             throw std::runtime_error("Failed to receive response payload");
         }
     }
     
-    if (resp_header.code == RES_GENERAL_ERROR) {
-        throw std::runtime_error("Server responded with an error");
+    return payload;
+}
+
+void MessageUClient::refreshDirectory() {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_LIST_RESOLVE);
+    auto request = Protocol::packClientListSinceRequest(client_id, directory.getCursor());
+    
+    if (!sendRequest(request)) {
+        throw std::runtime_error("Failed to send client list request");
     }
     
-    return payload;
+    auto response = receiveResponse();
+    uint32_t cursor = 0;
+    auto new_clients = MessageUtils::parseClientListSince(response, &cursor);
+    directory.merge(new_clients, cursor);
 }
 
-void MessageUClient::registerClient() {
-    std::cout << "Enter username: ";
-    std::getline(std::cin, username);
+void MessageUClient::lookupClients(const std::vector<std::string>& names) {
+    std::vector<std::string> missing;
+    for (const auto& name : names) {
+        if (!directory.findByName(name)) {
+            missing.push_back(name);
+        }
+    }
     
+    if (missing.empty()) {
+        return;
+    }
+    
+    auto request = Protocol::packLookupRequest(client_id, missing);
+    
+    if (!sendRequest(request)) {
+        throw std::runtime_error("Failed to send lookup request");
+    }
+    
+    auto response = receiveResponse();
+    auto results = MessageUtils::parseLookupResponse(response);
+    
+    for (size_t i = 0; i < results.size() && i < missing.size(); i++) {
+        if (!results[i].found) {
+            continue;
+        }
+        
+        ClientInfo client;
+        std::memcpy(client.id, results[i].id, CLIENT_ID_SIZE);
+        client.name = missing[i];
+        directory.add(client);
+        public_key_cache.put(client.id, results[i].public_key);
+    }
+}
+
+bool MessageUClient::resolveClient(const std::string& name, uint8_t* target_id) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_LIST_RESOLVE);
+    // Names and IDs never change once registered, so a cached entry is always valid
+    const ClientInfo* client = directory.findByName(name);
+    if (!client) {
+        lookupClients(std::vector<std::string>(1, name));
+        client = directory.findByName(name);
+    }
+    
+    if (!client) {
+        return false;
+    }
+    
+    std::memcpy(target_id, client->id, CLIENT_ID_SIZE);
+    return true;
+}
+
+const std::vector<uint8_t>& MessageUClient::fetchPublicKey(const uint8_t* target_id) {
+    const std::vector<uint8_t>* cached = public_key_cache.find(target_id);
+    if (cached) {
+        return *cached;
+    }
+    
+    auto request = Protocol::packPublicKeyRequest(client_id, target_id);
+    sendRequest(request);
+    auto response = receiveResponse();
+    
+    uint8_t resp_id[CLIENT_ID_SIZE];
+    auto public_key = MessageUtils::parsePublicKey(response, resp_id);
+    public_key_cache.put(target_id, public_key);
+    return *public_key_cache.find(target_id);
+}
+
+bool MessageUClient::registerAs(const std::string& name) {
+    username = name;
+    
+    delete rsa_private;
     rsa_private = new RSAPrivateWrapper();
     auto public_key = rsa_private->getPublicKey();
     
@@ -174,16 +303,28 @@ void MessageUClient::registerClient() {
     }
     
     auto response = receiveResponse();
+    releaseConnection();
+    
+    if (response.size() < CLIENT_ID_SIZE) {
+        return false;
+    }
+    
+    std::memcpy(client_id, response.data(), CLIENT_ID_SIZE);
+    registered = true;
+    saveMyInfo();
+    symmetric_keys.attach(SYMMETRIC_KEYS_FILE, *rsa_private, true);
+    return true;
+}
+
+void MessageUClient::registerClient() {
+    std::string name;
+    std::cout << "Enter username: ";
+    std::getline(std::cin, name);
     
-    if (response.size() >= CLIENT_ID_SIZE) {
-        std::memcpy(client_id, response.data(), CLIENT_ID_SIZE);
-        registered = true;
-        saveMyInfo();
+    if (registerAs(name)) {
         std::cout << "Registration successful!" << std::endl;
         std::cout << "Client ID: " << MessageUtils::clientIdToString(client_id) << std::endl;
     }
-    
-    disconnect();
 }
 
 void MessageUClient::requestClientList() {
@@ -191,21 +332,14 @@ void MessageUClient::requestClientList() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto request = Protocol::packClientListRequest(client_id);
-    
-    if (!sendRequest(request)) {
-        throw std::runtime_error("Failed to send client list request");
-    }
-    
-    auto response = receiveResponse();
-    auto clients = MessageUtils::parseClientList(response);
+    refreshDirectory();
     
     std::cout << "\n=== Client List ===" << std::endl;
-    for (const auto& client : clients) {
+    for (const auto& client : directory.getClients()) {
         std::cout << client.name << " (" << MessageUtils::clientIdToString(client.id) << ")" << std::endl;
     }
     
-    disconnect();
+    releaseConnection();
 }
 
 void MessageUClient::requestPublicKey() {
@@ -217,37 +351,18 @@ void MessageUClient::requestPublicKey() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
-    
     uint8_t target_id[CLIENT_ID_SIZE];
-    bool found = false;
-    for (const auto& client : clients) {
-        if (client.name == target_name) {
-            std::memcpy(target_id, client.id, CLIENT_ID_SIZE);
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!resolveClient(target_name, target_id)) {
         std::cout << "Client not found" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
-    auto request = Protocol::packPublicKeyRequest(client_id, target_id);
-    sendRequest(request);
-    auto response = receiveResponse();
-    
-    uint8_t resp_id[CLIENT_ID_SIZE];
-    auto public_key = MessageUtils::parsePublicKey(response, resp_id);
+    const auto& public_key = fetchPublicKey(target_id);
     
     std::cout << "Public key received (" << public_key.size() << " bytes)" << std::endl;
     
-    disconnect();
+    releaseConnection();
 }
 
 void MessageUClient::requestWaitingMessages() {
@@ -255,146 +370,543 @@ void MessageUClient::requestWaitingMessages() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
+    std::cout << "\n=== Waiting Messages ===" << std::endl;
+    
+    size_t count = 0;
     
-    // Build lookup table to display sender names instead of hex IDs
-    std::map<std::string, std::string> id_to_name;
-    for (const auto& client : clients) {
-        std::string id_str = MessageUtils::clientIdToString(client.id);
-        id_to_name[id_str] = client.name;
+    // Anything the background poller already fetched comes first; it is still
+    // on the server, so the pages continue after it and the first ack covers it
+    std::vector<Message> polled;
+    if (background) {
+        polled = background->takeInbox();
+    }
+    // Everything up to shown_through was acknowledged, or is held back by a
+    // download still running in the background
+    uint32_t cursor = shown_through;
+    for (const auto& msg : polled) {
+        cursor = std::max(cursor, msg.id);
     }
     
-    auto request = Protocol::packWaitingMessagesRequest(client_id);
+    readMailbox(cursor, shown_through,
+        [&](MailboxReader& mailbox, std::vector<Message>& held) {
+            if (crypto_threads != 1) {
+                count += displayInParallel(std::move(polled), mailbox, held);
+            } else {
+                for (const auto& msg : polled) {
+                    count++;
+                    if (holdUntilPageEnd(msg)) {
+                        held.push_back(msg);
+                    } else {
+                        displayMessage(msg, nullptr);
+                    }
+                }
+                count += readPage(mailbox, held, [this](const Message& msg, MailboxReader& reader) {
+                    displayMessage(msg, &reader);
+                });
+            }
+            polled.clear();
+        },
+        [&](const std::vector<Message>& held, uint32_t last_id) {
+            for (const auto& msg : held) {
+                displayMessage(msg, nullptr);
+            }
+            return last_id;
+        });
+    
+    if (background && shown_through > 0) {
+        background->acknowledged(shown_through);
+    }
+    
+    if (count == 0) {
+        std::cout << "No messages" << std::endl;
+    }
     
+    releaseConnection();
+}
+
+void MessageUClient::readMailbox(uint32_t cursor, uint32_t& acked,
+                                 const std::function<void(MailboxReader&, std::vector<Message>&)>& read_page,
+                                 const std::function<uint32_t(const std::vector<Message>&, uint32_t)>& finish_page) {
+    // A page at a time, each acknowledged once it has been handled, so memory
+    // doesn't grow with the backlog and a crash loses nothing: at worst the
+    // unacknowledged page is shown again
+    bool more = true;
+    while (more) {
+        uint32_t records_size = requestMessagePage(cursor, more);
+        
+        std::vector<Message> held;
+        {
+            MailboxReader mailbox(connection, records_size);
+            read_page(mailbox, held);
+            cursor = std::max(cursor, mailbox.lastId());
+        }
+        
+        // One refresh covers every new sender on the page; most pages need none
+        for (const auto& msg : held) {
+            if (!directory.findById(msg.from_client)) {
+                refreshDirectory();
+                break;
+            }
+        }
+        
+        uint32_t through_id = finish_page(held, cursor);
+        if (through_id > acked) {
+            // Acknowledging deletes the chunks of chunked files, which may
+            // still be downloading in the background
+            if (background) {
+                background->acknowledge(client_id, through_id);
+            } else {
+                acknowledgeMessages(through_id);
+            }
+            acked = through_id;
+        }
+    }
+}
+
+bool MessageUClient::holdUntilPageEnd(const Message& msg) const {
+    return MessageUtils::isChunkedFile(msg.type) || !directory.findById(msg.from_client);
+}
+
+size_t MessageUClient::readPage(MailboxReader& mailbox, std::vector<Message>& held,
+                                const std::function<void(const Message&, MailboxReader&)>& handle) {
+    size_t count = 0;
+    Message msg;
+    while (mailbox.next(msg)) {
+        count++;
+        
+        if (holdUntilPageEnd(msg)) {
+            mailbox.readContent(msg.content);
+            held.push_back(msg);
+            continue;
+        }
+        
+        // Files are streamed from the socket to disk; everything else is small
+        if (msg.type != MSG_TYPE_FILE) {
+            mailbox.readContent(msg.content);
+        }
+        handle(msg, mailbox);
+    }
+    return count;
+}
+
+uint32_t MessageUClient::requestMessagePage(uint32_t after_id, bool& more) {
+    auto request = Protocol::packMessagePageRequest(client_id, after_id, MESSAGE_PAGE_MESSAGES,
+                                                    MESSAGE_PAGE_BYTES);
     if (!sendRequest(request)) {
-        throw std::runtime_error("Failed to send waiting messages request");
+        throw std::runtime_error("Failed to send message page request");
     }
     
-    auto response = receiveResponse();
-    auto messages = MessageUtils::parseMessages(response);
+    ResponseHeader header = receiveResponseHeader();
+    uint8_t more_flag = 0;
+    if (header.code != RES_MESSAGE_PAGE || header.payload_size < 1 || !connection.recvAll(&more_flag, 1)) {
+        // The rest of the payload can't be accounted for
+        connection.close();
+        throw std::runtime_error("Invalid message page response");
+    }
     
-    std::cout << "\n=== Waiting Messages ===" << std::endl;
-    if (messages.empty()) {
-        std::cout << "No messages" << std::endl;
-    } else {
-        for (const auto& msg : messages) {
-            std::string sender_id = MessageUtils::clientIdToString(msg.from_client);
-            std::string sender_name = id_to_name.count(sender_id) ? id_to_name[sender_id] : "Unknown";
-            
-            std::cout << "From: " << sender_name << std::endl;
-            
-            std::cout << "Type: ";
-            switch (msg.type) {
-                case MSG_TYPE_SYM_KEY_REQUEST:
-                    std::cout << "Request for symmetric key" << std::endl;
-                    break;
-                case MSG_TYPE_SYM_KEY_SEND:
-                    std::cout << "Symmetric key (encrypted)" << std::endl;
-                    std::cout << "Received encrypted symmetric key (" << msg.content.size() << " bytes)" << std::endl;
-                    
-                    try {
-                        std::cout << "Decrypting symmetric key..." << std::endl;
-                        // RSA decrypt returns the AES key that was encrypted with our public key
-                        auto decrypted_key_str = rsa_private->decrypt(msg.content);
-                        std::vector<uint8_t> decrypted_key(decrypted_key_str.begin(), decrypted_key_str.end());
-                        
-                        saveSymmetricKey(msg.from_client, decrypted_key);
-                        std::cout << "Symmetric key decrypted and saved (" << decrypted_key.size() << " bytes)" << std::endl;
-                        std::cout << "Secure channel established with " << sender_name << std::endl;
-                        std::cout << "End-to-end encryption active" << std::endl;
-                    } catch (const std::exception& e) {
-                        std::cout << "Error: Failed to decrypt symmetric key: " << e.what() << std::endl;
-                        std::cout << "   The key might not have been encrypted for you." << std::endl;
-                    }
-                    break;
-                case MSG_TYPE_TEXT_MESSAGE:
-                    std::cout << "Text message" << std::endl;
-                    if (!msg.content.empty()) {
-                        if (hasSymmetricKey(msg.from_client)) {
-                            try {
-                                auto sym_key = getSymmetricKey(msg.from_client);
-                                AESWrapper aes(sym_key);
-                                auto decrypted = aes.decrypt(msg.content);
-                                std::string text(decrypted.begin(), decrypted.end());
-                                std::cout << "Content: " << text << std::endl;
-                            } catch (...) {
-                                std::cout << "Content: [encrypted, " << msg.content.size() << " bytes]" << std::endl;
-                                std::cout << "Warning: Could not decrypt message - key mismatch" << std::endl;
-                            }
-                        } else {
-                            std::cout << "Content: [encrypted, " << msg.content.size() << " bytes]" << std::endl;
-                            std::cout << "Warning: No decryption key available from " << sender_name << std::endl;
-                        }
-                    }
-                    break;
-                case MSG_TYPE_FILE:
-                    std::cout << "File" << std::endl;
-                    
-                    if (hasSymmetricKey(msg.from_client)) {
-                        try {
-                            auto sym_key = getSymmetricKey(msg.from_client);
-                            AESWrapper aes(sym_key);
-                            auto decrypted_file = aes.decrypt(msg.content);
-                            
-                            // Cross-platform temp directory resolution (Windows/Unix)
-                            const char* tmp_dir = std::getenv("TMP");
-                            if (!tmp_dir) {
-                                tmp_dir = std::getenv("TEMP");
-                            }
-                            if (!tmp_dir) {
-                                tmp_dir = "/tmp";
-                            }
-                            
-                            std::string filename = std::string(tmp_dir) + "/received_" + 
-                                                  std::to_string(msg.id) + ".bin";
-                            
-                            std::ofstream out(filename, std::ios::binary);
-                            if (out) {
-                                out.write(reinterpret_cast<const char*>(decrypted_file.data()), 
-                                        decrypted_file.size());
-                                out.close();
-                                
-                                std::cout << "Content: " << filename << std::endl;
-                                std::cout << "         (File saved to TMP folder, " << decrypted_file.size() << " bytes)" << std::endl;
-                            } else {
-                                std::cout << "Content: [Failed to save file]" << std::endl;
-                            }
-                        } catch (...) {
-                            std::cout << "Content: [Could not decrypt - key mismatch]" << std::endl;
-                        }
-                    } else {
-                        std::cout << "Content: [No decryption key available]" << std::endl;
-                    }
-                    break;
-                default:
-                    std::cout << "Unknown (" << static_cast<int>(msg.type) << ")" << std::endl;
-                    std::cout << "Content: " << msg.content.size() << " bytes" << std::endl;
-                    break;
+    more = more_flag != 0;
+    return header.payload_size - 1;
+}
+
+void MessageUClient::acknowledgeMessages(uint32_t through_id) {
+    auto request = Protocol::packAckMessagesRequest(client_id, through_id);
+    if (!sendRequest(request)) {
+        throw std::runtime_error("Failed to send acknowledgement");
+    }
+    receiveResponse();
+}
+
+// Content read ahead of the message being printed; past this the oldest
+// message is waited for and printed before reading on
+static constexpr uint64_t DECRYPT_BACKLOG_BYTES = 64 * 1024 * 1024;
+// Plain files larger than this are streamed from the socket to disk on the
+// main thread, as readPage does, instead of being read ahead into memory
+static constexpr uint32_t STREAMED_FILE_BYTES = 1024 * 1024;
+
+struct MessageUClient::PreparedMessage {
+    Message msg;
+    size_t content_size = 0;
+    // The sender's AES key as of this message's place in the mailbox, which
+    // an earlier key send may still be unwrapping; empty if there is none
+    std::shared_future<std::vector<uint8_t>> key;
+    // MSG_TYPE_SYM_KEY_SEND only: the sender's key for the messages after it
+    std::promise<std::vector<uint8_t>> next_key;
+    // Plaintext of a text message, or the key unwrapped from a key send
+    std::vector<uint8_t> plaintext;
+    std::string filename;
+    uint64_t written = 0;
+    bool saved = false;
+    std::exception_ptr error;
+    std::future<void> done;
+    
+    // Rethrows what the worker ran into, so displayMessage reports it as it
+    // would its own failure
+    const std::vector<uint8_t>& result() const {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return plaintext;
+    }
+};
+
+size_t MessageUClient::displayInParallel(std::vector<Message> polled, MailboxReader& mailbox,
+                                         std::vector<Message>& held) {
+    std::deque<std::unique_ptr<PreparedMessage>> pending;
+    uint64_t pending_bytes = 0;
+    // Each sender's latest key, including keys queued for unwrapping
+    std::unordered_map<std::string, std::shared_future<std::vector<uint8_t>>> keys;
+    size_t count = 0;
+    
+    auto display_oldest = [&]() {
+        PreparedMessage& oldest = *pending.front();
+        if (oldest.done.valid()) {
+            oldest.done.wait();
+        }
+        displayMessage(oldest.msg, nullptr, &oldest);
+        pending_bytes -= oldest.content_size;
+        pending.pop_front();
+    };
+    
+    auto queue = [&](Message&& msg) {
+        count++;
+        if (holdUntilPageEnd(msg)) {
+            held.push_back(std::move(msg));
+            return;
+        }
+        
+        std::unique_ptr<PreparedMessage> prepared(new PreparedMessage);
+        prepared->msg = std::move(msg);
+        prepared->content_size = prepared->msg.content.size();
+        
+        uint8_t type = prepared->msg.type;
+        if (type == MSG_TYPE_SYM_KEY_SEND || type == MSG_TYPE_TEXT_MESSAGE || type == MSG_TYPE_FILE ||
+            compression::isCompressedType(type)) {
+            const uint8_t* sender = prepared->msg.from_client;
+            std::string sender_key(reinterpret_cast<const char*>(sender), CLIENT_ID_SIZE);
+            auto known = keys.find(sender_key);
+            if (known == keys.end()) {
+                std::promise<std::vector<uint8_t>> stored;
+                const uint8_t* key = symmetric_keys.find(sender);
+                stored.set_value(key ? std::vector<uint8_t>(key, key + SymmetricKeyStore::KEY_SIZE)
+                                     : std::vector<uint8_t>());
+                known = keys.emplace(sender_key, stored.get_future().share()).first;
+            }
+            prepared->key = known->second;
+            if (type == MSG_TYPE_SYM_KEY_SEND) {
+                known->second = prepared->next_key.get_future().share();
+            }
+            if (compression::baseType(type) == MSG_TYPE_FILE) {
+                prepared->filename = receivedFilePath(prepared->msg.id);
             }
             
-            std::cout << "---" << std::endl;
+            PreparedMessage* task = prepared.get();
+            prepared->done = cryptoPool().submit([this, task]() { prepareMessage(*task); });
+        }
+        
+        pending_bytes += prepared->content_size;
+        pending.push_back(std::move(prepared));
+        while (!pending.empty() && pending_bytes > DECRYPT_BACKLOG_BYTES) {
+            display_oldest();
+        }
+    };
+    
+    try {
+        for (auto& msg : polled) {
+            queue(std::move(msg));
+        }
+        Message msg;
+        while (mailbox.next(msg)) {
+            if (msg.type == MSG_TYPE_FILE && mailbox.contentSize() > STREAMED_FILE_BYTES &&
+                !holdUntilPageEnd(msg)) {
+                // Everything ahead of it is printed first, which also saves
+                // any key it was encrypted with
+                while (!pending.empty()) {
+                    display_oldest();
+                }
+                count++;
+                displayMessage(msg, &mailbox);
+                continue;
+            }
+            mailbox.readContent(msg.content);
+            queue(std::move(msg));
+        }
+        while (!pending.empty()) {
+            display_oldest();
         }
+    } catch (...) {
+        // Workers still hold pointers into pending
+        for (auto& prepared : pending) {
+            if (prepared->done.valid()) {
+                prepared->done.wait();
+            }
+        }
+        throw;
+    }
+    return count;
+}
+
+void MessageUClient::prepareMessage(PreparedMessage& prepared) {
+    const Message& msg = prepared.msg;
+    try {
+        if (msg.type == MSG_TYPE_SYM_KEY_SEND) {
+            prepared.plaintext = unwrapSymmetricKey(msg.content);
+        } else {
+            const std::vector<uint8_t>& key = prepared.key.get();
+            if (key.empty()) {
+                throw std::runtime_error("No symmetric key for this client");
+            }
+            // Per message, since a cipher can't be shared between threads
+            AESWrapper aes(key);
+            if (msg.type == MSG_TYPE_TEXT_MESSAGE) {
+                prepared.plaintext.resize(msg.content.size());
+                prepared.plaintext.resize(aes.decrypt(msg.content.data(), msg.content.size(),
+                                                      prepared.plaintext.data()));
+            } else if (msg.type == MSG_TYPE_TEXT_COMPRESSED) {
+                prepared.plaintext = compression::decryptContent(aes, msg.type, msg.content);
+            } else {
+                if (msg.type == MSG_TYPE_FILE_COMPRESSED) {
+                    prepared.msg.content = compression::decryptContent(aes, msg.type, msg.content);
+                } else {
+                    aes.decryptInPlace(prepared.msg.content);
+                }
+                INSTRUMENT_TIMER(timer, instrument::PHASE_DISK_WRITE);
+                INSTRUMENT_ADD_BYTES(timer, msg.content.size());
+                std::ofstream out(prepared.filename, std::ios::binary);
+                out.write(reinterpret_cast<const char*>(msg.content.data()), msg.content.size());
+                prepared.written = msg.content.size();
+                prepared.saved = static_cast<bool>(out);
+                std::vector<uint8_t>().swap(prepared.msg.content);
+            }
+        }
+    } catch (...) {
+        prepared.error = std::current_exception();
     }
     
-    disconnect();
+    if (msg.type == MSG_TYPE_SYM_KEY_SEND) {
+        // A key that can't be unwrapped isn't saved, so the previous one stays
+        prepared.next_key.set_value(prepared.error ? prepared.key.get() : prepared.plaintext);
+    }
+}
+
+std::vector<uint8_t> MessageUClient::unwrapSymmetricKey(const std::vector<uint8_t>& wrapped) {
+    std::vector<uint8_t> key;
+    {
+        std::lock_guard<std::mutex> lock(rsa_mutex);
+        key = rsa_private->decrypt(wrapped);
+    }
+    if (key.size() != AESWrapper::KEY_SIZE) {
+        throw std::runtime_error("Invalid symmetric key size");
+    }
+    return key;
+}
+
+std::string MessageUClient::senderName(const uint8_t* sender_id) const {
+    const ClientInfo* sender = directory.findById(sender_id);
+    return sender ? sender->name : "Unknown";
+}
+
+MessageUClient::ReceivedMessage MessageUClient::decodeMessage(const Message& msg, MailboxReader* mailbox,
+                                                              const PreparedMessage* prepared) {
+    ReceivedMessage received;
+    switch (msg.type) {
+        case MSG_TYPE_SYM_KEY_SEND:
+            try {
+                // RSA decrypt returns the AES key that was encrypted with our public key
+                received.plaintext = prepared ? prepared->result() : unwrapSymmetricKey(msg.content);
+                saveSymmetricKey(msg.from_client, received.plaintext);
+            } catch (const std::exception& e) {
+                received.error = e.what();
+            }
+            break;
+        case MSG_TYPE_TEXT_MESSAGE:
+        case MSG_TYPE_TEXT_COMPRESSED:
+            if (msg.content.empty()) {
+                break;
+            }
+            if (!hasSymmetricKey(msg.from_client)) {
+                received.no_key = true;
+                break;
+            }
+            try {
+                received.plaintext = prepared ? prepared->result()
+                                              : compression::decryptContent(symmetricCipher(msg.from_client),
+                                                                            msg.type, msg.content);
+            } catch (const std::exception& e) {
+                received.error = e.what();
+            }
+            break;
+        case MSG_TYPE_FILE:
+        case MSG_TYPE_FILE_COMPRESSED:
+            // Without a key the unread content is skipped by the next mailbox read
+            if (!hasSymmetricKey(msg.from_client)) {
+                received.no_key = true;
+                break;
+            }
+            received.filename = receivedFilePath(msg.id);
+            try {
+                if (prepared) {
+                    prepared->result();
+                    received.written = prepared->written;
+                    received.saved = prepared->saved;
+                } else if (mailbox && msg.type == MSG_TYPE_FILE) {
+                    received.saved = receiveFileContent(msg, *mailbox, received.filename, &received.written);
+                } else {
+                    // Compressed, or fetched by the background poller, so already in memory
+                    AESWrapper& aes = symmetricCipher(msg.from_client);
+                    auto decrypted = compression::decryptContent(aes, msg.type, msg.content);
+                    INSTRUMENT_TIMER(timer, instrument::PHASE_DISK_WRITE);
+                    INSTRUMENT_ADD_BYTES(timer, decrypted.size());
+                    std::ofstream out(received.filename, std::ios::binary);
+                    out.write(reinterpret_cast<const char*>(decrypted.data()), decrypted.size());
+                    received.written = decrypted.size();
+                    received.saved = static_cast<bool>(out);
+                }
+            } catch (const std::exception& e) {
+                std::remove(received.filename.c_str());
+                received.error = e.what();
+            }
+            break;
+        default:
+            break;
+    }
+    return received;
+}
+
+void MessageUClient::displayMessage(const Message& msg, MailboxReader* mailbox,
+                                    const PreparedMessage* prepared) {
+    std::string sender_name = senderName(msg.from_client);
+    ReceivedMessage received;
+    if (!MessageUtils::isChunkedFile(msg.type)) {
+        received = decodeMessage(msg, mailbox, prepared);
+    }
+    
+    std::cout << "From: " << sender_name << std::endl;
+    
+    std::cout << "Type: ";
+    switch (msg.type) {
+        case MSG_TYPE_SYM_KEY_REQUEST:
+            std::cout << "Request for symmetric key" << std::endl;
+            break;
+        case MSG_TYPE_SYM_KEY_SEND:
+            std::cout << "Symmetric key (encrypted)" << std::endl;
+            std::cout << "Received encrypted symmetric key (" << msg.content.size() << " bytes)" << std::endl;
+            std::cout << "Decrypting symmetric key..." << std::endl;
+            if (received.error.empty()) {
+                std::cout << "Symmetric key decrypted and saved (" << received.plaintext.size() << " bytes)" << std::endl;
+                std::cout << "Secure channel established with " << sender_name << std::endl;
+                std::cout << "End-to-end encryption active" << std::endl;
+            } else {
+                std::cout << "Error: Failed to decrypt symmetric key: " << received.error << std::endl;
+                std::cout << "   The key might not have been encrypted for you." << std::endl;
+            }
+            break;
+        case MSG_TYPE_TEXT_MESSAGE:
+        case MSG_TYPE_TEXT_COMPRESSED:
+            std::cout << "Text message" << std::endl;
+            if (msg.content.empty()) {
+                break;
+            }
+            if (received.no_key) {
+                std::cout << "Content: [encrypted, " << msg.content.size() << " bytes]" << std::endl;
+                std::cout << "Warning: No decryption key available from " << sender_name << std::endl;
+            } else if (!received.error.empty()) {
+                std::cout << "Content: [encrypted, " << msg.content.size() << " bytes]" << std::endl;
+                std::cout << "Warning: Could not decrypt message - key mismatch" << std::endl;
+            } else {
+                std::cout << "Content: " << std::string(received.plaintext.begin(), received.plaintext.end()) << std::endl;
+            }
+            break;
+        case MSG_TYPE_FILE:
+        case MSG_TYPE_FILE_COMPRESSED:
+            std::cout << "File" << std::endl;
+            if (received.no_key) {
+                std::cout << "Content: [No decryption key available]" << std::endl;
+            } else if (!received.error.empty()) {
+                std::cout << "Content: [Could not decrypt - key mismatch]" << std::endl;
+            } else if (received.saved) {
+                std::cout << "Content: " << received.filename << std::endl;
+                std::cout << "         (File saved to TMP folder, " << received.written << " bytes)" << std::endl;
+            } else {
+                std::cout << "Content: [Failed to save file]" << std::endl;
+            }
+            break;
+        case MSG_TYPE_FILE_CHUNKED:
+        case MSG_TYPE_FILE_CHUNKED_IV:
+        case MSG_TYPE_FILE_CHUNKED_COMPRESSED:
+            std::cout << "File (chunked)" << std::endl;
+            
+            if (hasSymmetricKey(msg.from_client)) {
+                // Chunks are fetched on the background connection so the menu
+                // doesn't wait for the whole file
+                std::string filename = receivedFilePath(msg.id);
+                backgroundTasks().download(client_id, msg, sender_name, getSymmetricKey(msg.from_client), filename);
+                std::cout << "Content: " << filename << std::endl;
+                std::cout << "         (Downloading in background, option 160 shows progress)" << std::endl;
+            } else {
+                std::cout << "Content: [No decryption key available]" << std::endl;
+            }
+            break;
+        default:
+            std::cout << "Unknown (" << static_cast<int>(msg.type) << ")" << std::endl;
+            std::cout << "Content: " << msg.content.size() << " bytes" << std::endl;
+            break;
+    }
+    
+    std::cout << "---" << std::endl;
+}
+
+bool MessageUClient::receiveFileContent(const Message& msg, MailboxReader& mailbox,
+                                        const std::string& filename, uint64_t* written) {
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    
+    AESWrapper& aes = symmetricCipher(msg.from_client);
+    AESWrapper::Decryptor decryptor(aes);
+    std::vector<uint8_t> plaintext;
+    *written = 0;
+    
+    // Socket reads are counted by the mailbox; writes are timed per block
+    auto store = [&]() {
+        INSTRUMENT_TIMER(timer, instrument::PHASE_DISK_WRITE);
+        INSTRUMENT_ADD_BYTES(timer, plaintext.size());
+        out.write(reinterpret_cast<const char*>(plaintext.data()), plaintext.size());
+        *written += plaintext.size();
+    };
+    mailbox.streamContent([&](const uint8_t* data, size_t length) {
+        decryptor.update(data, length, plaintext);
+        store();
+    });
+    
+    decryptor.finish(plaintext);
+    store();
+    
+    return static_cast<bool>(out);
 }
 
 bool MessageUClient::hasSymmetricKey(const uint8_t* target_id) {
-    std::string id_str = MessageUtils::clientIdToString(target_id);
-    return symmetric_keys.count(id_str) > 0;
+    return symmetric_keys.contains(target_id);
 }
 
 void MessageUClient::saveSymmetricKey(const uint8_t* target_id, const std::vector<uint8_t>& key) {
-    std::string id_str = MessageUtils::clientIdToString(target_id);
-    symmetric_keys[id_str] = key;
+    symmetric_keys.put(target_id, key);
 }
 
 std::vector<uint8_t> MessageUClient::getSymmetricKey(const uint8_t* target_id) {
-    std::string id_str = MessageUtils::clientIdToString(target_id);
-    return symmetric_keys[id_str];
+    const uint8_t* key = symmetric_keys.find(target_id);
+    if (!key) {
+        throw std::runtime_error("No symmetric key for this client");
+    }
+    return std::vector<uint8_t>(key, key + SymmetricKeyStore::KEY_SIZE);
+}
+
+AESWrapper& MessageUClient::symmetricCipher(const uint8_t* target_id) {
+    AESWrapper* aes = symmetric_keys.cipher(target_id);
+    if (!aes) {
+        throw std::runtime_error("No symmetric key for this client");
+    }
+    return *aes;
 }
 
 void MessageUClient::sendTextMessage() {
@@ -406,24 +918,10 @@ void MessageUClient::sendTextMessage() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
-    
     uint8_t target_id[CLIENT_ID_SIZE];
-    bool found = false;
-    for (const auto& client : clients) {
-        if (client.name == target_name) {
-            std::memcpy(target_id, client.id, CLIENT_ID_SIZE);
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!resolveClient(target_name, target_id)) {
         std::cout << "Client not found" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
@@ -436,29 +934,158 @@ void MessageUClient::sendTextMessage() {
         std::cout << "  3. Check messages (option 140) to receive the key" << std::endl;
         std::cout << "  4. Then you can send encrypted messages" << std::endl;
         std::cout << "\nMessage NOT sent (encryption required)" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
     std::cout << "Enter message: ";
     std::getline(std::cin, message);
     
-    auto sym_key = getSymmetricKey(target_id);
-    AESWrapper aes(sym_key);
-    std::vector<uint8_t> plaintext(message.begin(), message.end());
-    std::vector<uint8_t> encrypted = aes.encrypt(plaintext);
-    
-    auto request = Protocol::packSendMessageRequest(
-        client_id, target_id, MSG_TYPE_TEXT_MESSAGE, encrypted
-    );
+    AESWrapper& aes = symmetricCipher(target_id);
+    uint8_t type = MSG_TYPE_TEXT_MESSAGE;
+    std::vector<uint8_t> encrypted = compression::encryptContent(
+        aes, type, reinterpret_cast<const uint8_t*>(message.data()), message.size());
     
-    sendRequest(request);
+    sendMessageRequest(target_id, type, encrypted);
     receiveResponse();
     
     std::cout << "Message sent successfully to " << target_name << std::endl;
     std::cout << "   (encrypted with AES-128, " << encrypted.size() << " bytes)" << std::endl;
     
-    disconnect();
+    releaseConnection();
+}
+
+void MessageUClient::sendTextBatch() {
+    std::string names_line, message;
+    std::cout << "Enter recipient names (comma separated): ";
+    std::getline(std::cin, names_line);
+    
+    std::vector<std::string> names;
+    std::istringstream names_stream(names_line);
+    std::string name;
+    while (std::getline(names_stream, name, ',')) {
+        size_t first = name.find_first_not_of(' ');
+        size_t last = name.find_last_not_of(' ');
+        if (first != std::string::npos) {
+            names.push_back(name.substr(first, last - first + 1));
+        }
+    }
+    
+    if (names.empty()) {
+        std::cout << "No recipients given" << std::endl;
+        return;
+    }
+    
+    std::cout << "Enter message: ";
+    std::getline(std::cin, message);
+    std::vector<uint8_t> plaintext(message.begin(), message.end());
+    // Compressed once, then encrypted for each recipient
+    uint8_t type = MSG_TYPE_TEXT_MESSAGE;
+    std::vector<uint8_t> frame;
+    if (compression::compress(plaintext.data(), plaintext.size(), frame)) {
+        plaintext.swap(frame);
+        type = MSG_TYPE_TEXT_COMPRESSED;
+    }
+    
+    if (!connect()) {
+        throw std::runtime_error("Could not connect to server");
+    }
+    
+    // One lookup for every name we haven't resolved before
+    lookupClients(names);
+    
+    std::vector<std::string> queued_names;
+    for (const auto& target_name : names) {
+        const ClientInfo* client = directory.findByName(target_name);
+        if (!client) {
+            std::cout << "Skipping " << target_name << ": client not found" << std::endl;
+            continue;
+        }
+        if (!hasSymmetricKey(client->id)) {
+            std::cout << "Skipping " << target_name << ": no symmetric key (use option 151 first)" << std::endl;
+            continue;
+        }
+        
+        AESWrapper& aes = symmetricCipher(client->id);
+        queueMessage(client->id, type, aes.encrypt(plaintext));
+        queued_names.push_back(target_name);
+    }
+    
+    std::string failure;
+    auto message_ids = flushOutbox(failure);
+    
+    size_t delivered = 0;
+    for (size_t i = 0; i < queued_names.size(); i++) {
+        if (message_ids[i] != 0) {
+            delivered++;
+        } else if (!failure.empty()) {
+            std::cout << "Message to " << queued_names[i] << " not sent: " << failure << std::endl;
+        } else {
+            std::cout << "Server rejected message to " << queued_names[i] << std::endl;
+        }
+    }
+    std::cout << "Message sent to " << delivered << " of " << names.size() << " recipients" << std::endl;
+    
+    releaseConnection();
+}
+
+void MessageUClient::queueMessage(const uint8_t* target_id, uint8_t msg_type, const std::vector<uint8_t>& content) {
+    OutgoingMessage msg;
+    std::memcpy(msg.to_client, target_id, CLIENT_ID_SIZE);
+    msg.type = msg_type;
+    msg.content = content;
+    outbox.push_back(std::move(msg));
+}
+
+std::vector<uint32_t> MessageUClient::flushOutbox(std::string& failure) {
+    // Taken whole, so a flush that fails part way leaves nothing behind to be
+    // resent under the next caller's IDs
+    std::vector<OutgoingMessage> queued;
+    queued.swap(outbox);
+    failure.clear();
+    
+    std::vector<uint32_t> message_ids;
+    message_ids.reserve(queued.size());
+    
+    try {
+        RequestPipeline pipeline(connection, BATCH_WINDOW);
+        
+        size_t begin = 0;
+        while (begin < queued.size()) {
+            // Split so no single request grows past the batch limits
+            size_t end = begin;
+            size_t batch_bytes = 0;
+            while (end < queued.size() && end - begin < MAX_BATCH_MESSAGES) {
+                size_t record_size = CLIENT_ID_SIZE + 1 + 4 + queued[end].content.size();
+                if (end > begin && batch_bytes + record_size > MAX_BATCH_BYTES) {
+                    break;
+                }
+                batch_bytes += record_size;
+                end++;
+            }
+            
+            auto request = Protocol::packBatchSendRequest(client_id, queued, begin, end);
+            pipeline.submit(request, [&](const ResponseHeader& header, std::vector<uint8_t>& payload) {
+                if (header.code == RES_GENERAL_ERROR) {
+                    throw std::runtime_error("Server rejected message batch");
+                }
+                auto batch_ids = MessageUtils::parseBatchResponse(payload);
+                message_ids.insert(message_ids.end(), batch_ids.begin(), batch_ids.end());
+            });
+            
+            begin = end;
+        }
+        
+        pipeline.drain();
+    } catch (const std::exception& e) {
+        // Replies to batches still in flight would be read as the next response
+        disconnect();
+        failure = e.what();
+    }
+    
+    // Records without an acknowledged batch weren't delivered
+    message_ids.resize(queued.size(), 0);
+    return message_ids;
 }
 
 void MessageUClient::requestSymmetricKey() {
@@ -470,39 +1097,21 @@ void MessageUClient::requestSymmetricKey() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
-    
     uint8_t target_id[CLIENT_ID_SIZE];
-    bool found = false;
-    for (const auto& client : clients) {
-        if (client.name == target_name) {
-            std::memcpy(target_id, client.id, CLIENT_ID_SIZE);
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!resolveClient(target_name, target_id)) {
         std::cout << "Client not found" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
     std::vector<uint8_t> content;
-    auto request = Protocol::packSendMessageRequest(
-        client_id, target_id, MSG_TYPE_SYM_KEY_REQUEST, content
-    );
-    
-    sendRequest(request);
+    sendMessageRequest(target_id, MSG_TYPE_SYM_KEY_REQUEST, content);
     receiveResponse();
     
     std::cout << "Symmetric key request sent to " << target_name << std::endl;
     std::cout << "The recipient will receive your request and can send their key using option 152." << std::endl;
     
-    disconnect();
+    releaseConnection();
 }
 
 void MessageUClient::sendSymmetricKey() {
@@ -514,35 +1123,16 @@ void MessageUClient::sendSymmetricKey() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
-    
     uint8_t target_id[CLIENT_ID_SIZE];
-    bool found = false;
-    for (const auto& client : clients) {
-        if (client.name == target_name) {
-            std::memcpy(target_id, client.id, CLIENT_ID_SIZE);
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!resolveClient(target_name, target_id)) {
         std::cout << "Client not found" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
-    std::cout << "Fetching public key from server..." << std::endl;
-    auto pubkey_req = Protocol::packPublicKeyRequest(client_id, target_id);
-    sendRequest(pubkey_req);
-    auto pubkey_resp = receiveResponse();
-    
-    uint8_t resp_id[CLIENT_ID_SIZE];
-    auto target_public_key = MessageUtils::parsePublicKey(pubkey_resp, resp_id);
-    std::cout << "Public key received (" << target_public_key.size() << " bytes)" << std::endl;
+    // Usually cached from an earlier exchange or the name lookup, so no extra round trip
+    const auto& target_public_key = fetchPublicKey(target_id);
+    std::cout << "Public key available (" << target_public_key.size() << " bytes)" << std::endl;
     
     // Default constructor generates fresh AES-128 key automatically
     AESWrapper aes;
@@ -550,16 +1140,11 @@ void MessageUClient::sendSymmetricKey() {
     std::cout << "Generated AES symmetric key (" << symmetric_key.size() << " bytes)" << std::endl;
     
     std::cout << "Encrypting symmetric key..." << std::endl;
-    RSAPublicWrapper rsa_public(target_public_key);
-    std::string sym_key_str(symmetric_key.begin(), symmetric_key.end());
-    auto encrypted_sym_key = rsa_public.encrypt(sym_key_str);
+    auto rsa_public = public_key_cache.getWrapper(target_id);
+    auto encrypted_sym_key = rsa_public->encrypt(symmetric_key);
     std::cout << "Symmetric key encrypted (" << encrypted_sym_key.size() << " bytes)" << std::endl;
     
-    auto request = Protocol::packSendMessageRequest(
-        client_id, target_id, MSG_TYPE_SYM_KEY_SEND, encrypted_sym_key
-    );
-    
-    sendRequest(request);
+    sendMessageRequest(target_id, MSG_TYPE_SYM_KEY_SEND, encrypted_sym_key);
     receiveResponse();
     
     saveSymmetricKey(target_id, symmetric_key);
@@ -568,7 +1153,7 @@ void MessageUClient::sendSymmetricKey() {
     std::cout << "Symmetric key sent to " << target_name << std::endl;
     std::cout << "Secure channel established" << std::endl;
     
-    disconnect();
+    releaseConnection();
 }
 
 void MessageUClient::sendFile() {
@@ -580,24 +1165,10 @@ void MessageUClient::sendFile() {
         throw std::runtime_error("Could not connect to server");
     }
     
-    auto list_req = Protocol::packClientListRequest(client_id);
-    sendRequest(list_req);
-    auto list_resp = receiveResponse();
-    auto clients = MessageUtils::parseClientList(list_resp);
-    
     uint8_t target_id[CLIENT_ID_SIZE];
-    bool found = false;
-    for (const auto& client : clients) {
-        if (client.name == target_name) {
-            std::memcpy(target_id, client.id, CLIENT_ID_SIZE);
-            found = true;
-            break;
-        }
-    }
-    
-    if (!found) {
+    if (!resolveClient(target_name, target_id)) {
         std::cout << "Client not found" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
@@ -610,17 +1181,32 @@ void MessageUClient::sendFile() {
         std::cout << "  3. Check messages (option 140) to receive the key" << std::endl;
         std::cout << "  4. Then you can send encrypted files" << std::endl;
         std::cout << "\nFile NOT sent (encryption required)" << std::endl;
-        disconnect();
+        releaseConnection();
         return;
     }
     
     std::cout << "Enter filename: ";
     std::getline(std::cin, filename);
     
-    std::ifstream file(filename, std::ios::binary);
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file) {
         std::cout << "Error: file not found" << std::endl;
-        disconnect();
+        releaseConnection();
+        return;
+    }
+    
+    uint64_t file_size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    
+    if (file_size > FILE_CHUNK_SIZE) {
+        std::cout << "File size: " << file_size << " bytes (sending in "
+                  << FILE_CHUNK_SIZE << "-byte chunks)" << std::endl;
+        
+        file.close();
+        backgroundTasks().upload(client_id, target_id, target_name, filename, getSymmetricKey(target_id));
+        std::cout << "Sending in background (option 160 shows progress)" << std::endl;
+        
+        releaseConnection();
         return;
     }
     
@@ -634,22 +1220,207 @@ void MessageUClient::sendFile() {
     
     std::cout << "File size: " << file_contents.size() << " bytes" << std::endl;
     
-    auto sym_key = getSymmetricKey(target_id);
-    AESWrapper aes(sym_key);
-    std::vector<uint8_t> encrypted = aes.encrypt(file_contents);
+    AESWrapper& aes = symmetricCipher(target_id);
+    uint8_t type = MSG_TYPE_FILE;
+    std::vector<uint8_t> encrypted = compression::encryptContent(aes, type, file_contents.data(),
+                                                                 file_contents.size());
     
-    auto request = Protocol::packSendMessageRequest(
-        client_id, target_id, MSG_TYPE_FILE, encrypted
-    );
-    
-    sendRequest(request);
+    sendMessageRequest(target_id, type, encrypted);
     receiveResponse();
     
     std::cout << "File sent successfully to " << target_name << std::endl;
     std::cout << "Original size: " << file_contents.size() << " bytes" << std::endl;
     std::cout << "Encrypted size: " << encrypted.size() << " bytes" << std::endl;
     
-    disconnect();
+    releaseConnection();
+}
+
+uint64_t MessageUClient::sendFileChunks(Connection& conn, const uint8_t* target_id, std::istream& file,
+                                        uint64_t file_size, const std::vector<uint8_t>& key) {
+    std::random_device random;
+    uint32_t transfer_id = random();
+    uint32_t chunk_count = static_cast<uint32_t>((file_size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE);
+    
+    // Chunks are compressed whenever there is a codec to do it with
+    bool compressed = compression::builtIn() != compression::CODEC_NONE;
+    ChunkCipher cipher(cryptoPool(), key, compressed);
+    std::vector<std::vector<uint8_t>> batch;
+    uint64_t encrypted_total = 0;
+    
+    auto check_ack = [](const ResponseHeader& header, std::vector<uint8_t>&) {
+        if (header.code == RES_GENERAL_ERROR) {
+            throw std::runtime_error("Server rejected file chunk");
+        }
+    };
+    
+    try {
+        // Reading and encrypting the next chunks overlaps with the server
+        // storing the ones still in flight
+        RequestPipeline pipeline(conn, FILE_CHUNK_WINDOW);
+        
+        for (uint32_t index = 0; index < chunk_count; ) {
+            batch.resize(std::min<size_t>(cipher.batchSize(), chunk_count - index));
+            for (auto& chunk : batch) {
+                // Room for the padding and a frame header, so encrypting in
+                // place never reallocates
+                chunk.reserve(AESWrapper::framedSize(FILE_CHUNK_SIZE + compression::FRAME_HEADER_SIZE));
+                chunk.resize(AESWrapper::IV_SIZE + FILE_CHUNK_SIZE);
+                file.read(reinterpret_cast<char*>(chunk.data() + AESWrapper::IV_SIZE), FILE_CHUNK_SIZE);
+                chunk.resize(AESWrapper::IV_SIZE + static_cast<size_t>(file.gcount()));
+                if (chunk.size() == AESWrapper::IV_SIZE) {
+                    throw std::runtime_error("File shrank while it was being sent");
+                }
+            }
+            cipher.encrypt(batch, 0);
+            
+            for (const auto& chunk : batch) {
+                uint8_t prefix[FILE_CHUNK_PREFIX_SIZE];
+                Protocol::packFileChunkPrefix(prefix, client_id, target_id, transfer_id,
+                                              index, index + 1 == chunk_count, compressed, chunk.size());
+                encrypted_total += chunk.size();
+                
+                pipeline.submit(prefix, sizeof(prefix), chunk, check_ack);
+                index++;
+            }
+        }
+        
+        pipeline.drain();
+    } catch (...) {
+        // An ack may still be in flight; the stream can't be trusted any more
+        conn.close();
+        throw;
+    }
+    
+    return encrypted_total;
+}
+
+bool MessageUClient::receiveFileChunks(Connection& conn, const Message& msg, const std::vector<uint8_t>& key,
+                                       const std::string& filename, uint64_t* written) {
+    FileDescriptor descriptor = MessageUtils::parseFileDescriptor(msg.content);
+    
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    
+    *written = 0;
+    uint32_t expected_index = 0;
+    ChunkCipher cipher(cryptoPool(), key, msg.type == MSG_TYPE_FILE_CHUNKED_COMPRESSED);
+    std::vector<std::vector<uint8_t>> batch;
+    
+    // Chunks come back in request order, so a batch is decrypted together
+    // and written in order
+    auto store = [&]() {
+        cipher.decrypt(batch, 0);
+        for (const auto& chunk : batch) {
+            size_t length = chunk.size() - AESWrapper::IV_SIZE;
+            INSTRUMENT_TIMER(timer, instrument::PHASE_DISK_WRITE);
+            INSTRUMENT_ADD_BYTES(timer, length);
+            out.write(reinterpret_cast<const char*>(chunk.data() + AESWrapper::IV_SIZE), length);
+            *written += length;
+        }
+        batch.clear();
+    };
+    
+    RequestPipeline pipeline(conn, FILE_CHUNK_WINDOW);
+    for (uint32_t index = 0; index < descriptor.chunk_count; index++) {
+        auto request = Protocol::packFetchFileChunkRequest(client_id, msg.id, index);
+        pipeline.submit(request, [&](const ResponseHeader& header, std::vector<uint8_t>& payload) {
+            if (header.code == RES_GENERAL_ERROR) {
+                throw std::runtime_error("Server could not return file chunk");
+            }
+            batch.push_back(MessageUtils::parseFileChunk(payload, msg.id, expected_index++, msg.type));
+            if (batch.size() == cipher.batchSize()) {
+                store();
+            }
+        });
+    }
+    pipeline.drain();
+    store();
+    
+    return static_cast<bool>(out);
+}
+
+WorkerPool& MessageUClient::cryptoPool() {
+    if (!crypto_pool) {
+        crypto_pool.reset(new WorkerPool(crypto_threads));
+    }
+    return *crypto_pool;
+}
+
+BackgroundTasks& MessageUClient::backgroundTasks() {
+    if (!background) {
+        background.reset(new BackgroundTasks(server_ip, server_port, cryptoPool()));
+    }
+    return *background;
+}
+
+void MessageUClient::startPolling() {
+    if (!registered) {
+        return;
+    }
+    if (push_receive) {
+        backgroundTasks().startReceiving(client_id);
+        std::cout << "Receiving new messages as they arrive" << std::endl;
+        return;
+    }
+    if (poll_interval == 0) {
+        return;
+    }
+    backgroundTasks().startPolling(client_id, poll_interval);
+    std::cout << "Checking for new messages every " << poll_interval << " s" << std::endl;
+}
+
+void MessageUClient::showBackgroundJobs() {
+    if (!background || background->jobs().empty()) {
+        std::cout << "No background transfers" << std::endl;
+        return;
+    }
+    
+    std::cout << "\n=== Background Transfers ===" << std::endl;
+    for (const auto& entry : background->jobs()) {
+        const BackgroundTasks::JobStatus& job = entry.second;
+        std::cout << entry.first << ") " << job.description << ": ";
+        switch (job.state) {
+            case BackgroundTasks::JobState::Running:
+                std::cout << job.chunks_done << "/" << job.chunk_count << " chunks";
+                break;
+            case BackgroundTasks::JobState::Done:
+                std::cout << "done, " << job.detail;
+                break;
+            case BackgroundTasks::JobState::Failed:
+                std::cout << "failed, " << job.detail;
+                break;
+        }
+        std::cout << std::endl;
+    }
+}
+
+std::vector<ConnectionStats> MessageUClient::connectionStats() const {
+    std::vector<ConnectionStats> stats = connections.stats();
+    stats[session.index()] = connection.getStats();
+    return stats;
+}
+
+void MessageUClient::printConnectionStats() const {
+    std::vector<ConnectionStats> per_connection = connectionStats();
+    ConnectionStats total{0, 0, 0};
+    for (const auto& stats : per_connection) {
+        total.opened += stats.opened;
+        total.reused += stats.reused;
+        total.failed_attempts += stats.failed_attempts;
+    }
+    std::cout << "Connections: " << total.opened << " opened, "
+              << total.reused << " reused, "
+              << total.failed_attempts << " failed attempts" << std::endl;
+    if (per_connection.size() > 1) {
+        for (size_t i = 0; i < per_connection.size(); i++) {
+            std::cout << "  #" << i << (i == session.index() ? " (session)" : "") << ": "
+                      << per_connection[i].opened << " opened, "
+                      << per_connection[i].reused << " reused, "
+                      << per_connection[i].failed_attempts << " failed attempts" << std::endl;
+        }
+    }
 }
 
 void MessageUClient::showMenu() {
@@ -662,20 +1433,35 @@ void MessageUClient::showMenu() {
     std::cout << "151) Send a request for symmetric key" << std::endl;
     std::cout << "152) Send your symmetric key" << std::endl;
     std::cout << "153) Send a file" << std::endl;
+    std::cout << "154) Send a text message to several clients" << std::endl;
+    std::cout << "160) Show background transfers" << std::endl;
+    std::cout << "161) Show timing counters" << std::endl;
     std::cout << "0) Exit client" << std::endl;
     std::cout << "? ";
 }
 
 void MessageUClient::run() {
+    std::cout << "Server: " << server_ip << ":" << server_port << std::endl;
+    
     if (loadMyInfo()) {
         std::cout << "Loaded existing registration for: " << username << std::endl;
     }
     
+    size_t cached_keys = public_key_cache.load();
+    if (cached_keys > 0) {
+        std::cout << "Loaded " << cached_keys << " cached public keys" << std::endl;
+    }
+    
+    startPolling();
+    
     while (true) {
         showMenu();
         
         std::string choice;
-        std::getline(std::cin, choice);
+        if (!std::getline(std::cin, choice)) {
+            // End of input exits like 0, so background transfers still finish
+            choice = "0";
+        }
         
         if (choice.empty()) {
             continue;
@@ -684,7 +1470,7 @@ void MessageUClient::run() {
         try {
             for (char c : choice) {
                 if (!std::isdigit(c) && c != '-') {
-                    std::cout << "Invalid input. Please enter a number (110, 120, 130, 140, 150, 151, 152, 153, or 0)." << std::endl;
+                    std::cout << "Invalid input. Please enter a number (110, 120, 130, 140, 150, 151, 152, 153, 154, 160, 161, or 0)." << std::endl;
                     goto next_iteration;
                 }
             }
@@ -694,6 +1480,7 @@ void MessageUClient::run() {
             switch (cmd) {
                 case 110:
                     registerClient();
+                    startPolling();
                     break;
                 case 120:
                     if (!registered) {
@@ -744,7 +1531,29 @@ void MessageUClient::run() {
                     }
                     sendFile();
                     break;
+                case 154:
+                    if (!registered) {
+                        std::cout << "Please register first" << std::endl;
+                        break;
+                    }
+                    sendTextBatch();
+                    break;
+                case 160:
+                    showBackgroundJobs();
+                    break;
+                case 161:
+                    if (!instrument::COMPILED_IN) {
+                        std::cout << "Timing counters are not compiled in (rebuild with make INSTRUMENT=1)" << std::endl;
+                    }
+                    instrument::dump(std::cout);
+                    break;
                 case 0:
+                    if (background && background->activeJobs() > 0) {
+                        std::cout << "Waiting for " << background->activeJobs()
+                                  << " background transfer(s) to finish..." << std::endl;
+                        background->waitIdle();
+                    }
+                    printConnectionStats();
                     std::cout << "Goodbye!" << std::endl;
                     return;
                 default:
@@ -759,3 +1568,12 @@ void MessageUClient::run() {
     }
 }
 
+size_t MessageUClient::runScript(std::istream& in, std::ostream& out) {
+    // stdout carries only results in this mode
+    connections.setQuiet(true);
+    loadMyInfo();
+    public_key_cache.load();
+    
+    ScriptRunner runner(*this, out);
+    return runner.run(in);
+}
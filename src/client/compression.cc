@@ -0,0 +1,226 @@
+#include "compression.h"
+#include "protocol.h"
+#include "crypto/AESWrapper.h"
+
+#include <stdexcept>
+#include <string>
+
+#if defined(MESSAGEU_COMPRESS_ZLIB)
+#include <zlib.h>
+#elif defined(MESSAGEU_COMPRESS_ZSTD)
+#include <zstd.h>
+#elif defined(MESSAGEU_COMPRESS_LZ4)
+#include <lz4.h>
+#endif
+
+namespace compression {
+
+// Size of the sample compressed first from larger content
+static constexpr size_t PROBE_SIZE = 4096;
+
+Codec builtIn() {
+#if defined(MESSAGEU_COMPRESS_ZLIB)
+    return CODEC_ZLIB;
+#elif defined(MESSAGEU_COMPRESS_ZSTD)
+    return CODEC_ZSTD;
+#elif defined(MESSAGEU_COMPRESS_LZ4)
+    return CODEC_LZ4;
+#else
+    return CODEC_NONE;
+#endif
+}
+
+const char* codecName(Codec codec) {
+    switch (codec) {
+        case CODEC_NONE: return "none";
+        case CODEC_ZLIB: return "zlib";
+        case CODEC_ZSTD: return "zstd";
+        case CODEC_LZ4: return "lz4";
+    }
+    return "unknown";
+}
+
+// Largest compressed form of size bytes
+static size_t boundFor(size_t size) {
+#if defined(MESSAGEU_COMPRESS_ZLIB)
+    return ::compressBound(static_cast<uLong>(size));
+#elif defined(MESSAGEU_COMPRESS_ZSTD)
+    return ZSTD_compressBound(size);
+#elif defined(MESSAGEU_COMPRESS_LZ4)
+    return static_cast<size_t>(LZ4_compressBound(static_cast<int>(size)));
+#else
+    return size;
+#endif
+}
+
+// Returns the compressed size, 0 on failure
+static size_t compressInto(const uint8_t* data, size_t size, uint8_t* out, size_t capacity) {
+#if defined(MESSAGEU_COMPRESS_ZLIB)
+    uLongf length = static_cast<uLongf>(capacity);
+    return ::compress2(out, &length, data, static_cast<uLong>(size), Z_BEST_SPEED) == Z_OK ? length : 0;
+#elif defined(MESSAGEU_COMPRESS_ZSTD)
+    size_t length = ZSTD_compress(out, capacity, data, size, 3);
+    return ZSTD_isError(length) ? 0 : length;
+#elif defined(MESSAGEU_COMPRESS_LZ4)
+    int length = LZ4_compress_default(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(out),
+                                      static_cast<int>(size), static_cast<int>(capacity));
+    return length > 0 ? static_cast<size_t>(length) : 0;
+#else
+    (void)data; (void)size; (void)out; (void)capacity;
+    return 0;
+#endif
+}
+
+// True if exactly original bytes came out
+static bool decompressInto(const uint8_t* data, size_t size, uint8_t* out, size_t original) {
+#if defined(MESSAGEU_COMPRESS_ZLIB)
+    uLongf length = static_cast<uLongf>(original);
+    return ::uncompress(out, &length, data, static_cast<uLong>(size)) == Z_OK && length == original;
+#elif defined(MESSAGEU_COMPRESS_ZSTD)
+    size_t length = ZSTD_decompress(out, original, data, size);
+    return !ZSTD_isError(length) && length == original;
+#elif defined(MESSAGEU_COMPRESS_LZ4)
+    int length = LZ4_decompress_safe(reinterpret_cast<const char*>(data), reinterpret_cast<char*>(out),
+                                     static_cast<int>(size), static_cast<int>(original));
+    return length >= 0 && static_cast<size_t>(length) == original;
+#else
+    (void)data; (void)size; (void)out; (void)original;
+    return false;
+#endif
+}
+
+static void writeFrameHeader(uint8_t* out, Codec codec, size_t original) {
+    out[0] = codec;
+    for (int i = 0; i < 4; i++) {
+        out[1 + i] = static_cast<uint8_t>(original >> (8 * i));
+    }
+}
+
+static size_t originalSize(const uint8_t* frame) {
+    return frame[1] | (frame[2] << 8) | (frame[3] << 16) | (static_cast<size_t>(frame[4]) << 24);
+}
+
+bool compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    if (builtIn() == CODEC_NONE || size < MIN_SIZE || size > MAX_ORIGINAL_SIZE) {
+        return false;
+    }
+
+    // Content that doesn't compress (media, archives) would cost a whole
+    // failed pass, which for zlib is many times the encryption; a sample
+    // from the front decides whether to try
+    if (size >= 4 * PROBE_SIZE) {
+        std::vector<uint8_t> probe(boundFor(PROBE_SIZE));
+        size_t length = compressInto(data, PROBE_SIZE, probe.data(), probe.size());
+        if (length == 0 || length > PROBE_SIZE - PROBE_SIZE / 8) {
+            return false;
+        }
+    }
+
+    std::vector<uint8_t> frame(FRAME_HEADER_SIZE + boundFor(size));
+    size_t length = compressInto(data, size, frame.data() + FRAME_HEADER_SIZE, frame.size() - FRAME_HEADER_SIZE);
+    if (length == 0 || FRAME_HEADER_SIZE + length >= size) {
+        return false;
+    }
+
+    writeFrameHeader(frame.data(), builtIn(), size);
+    frame.resize(FRAME_HEADER_SIZE + length);
+    out.swap(frame);
+    return true;
+}
+
+std::vector<uint8_t> decompress(const uint8_t* frame, size_t size) {
+    if (size < FRAME_HEADER_SIZE) {
+        throw std::runtime_error("Invalid compressed content");
+    }
+
+    Codec codec = static_cast<Codec>(frame[0]);
+    if (codec != builtIn() || codec == CODEC_NONE) {
+        throw std::runtime_error(std::string("Content is compressed with ") + codecName(codec) +
+                                 ", which this build doesn't include");
+    }
+
+    size_t original = originalSize(frame);
+    if (original > MAX_ORIGINAL_SIZE) {
+        throw std::runtime_error("Compressed content is too large");
+    }
+
+    std::vector<uint8_t> data(original);
+    if (!decompressInto(frame + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE, data.data(), original)) {
+        throw std::runtime_error("Corrupt compressed content");
+    }
+    return data;
+}
+
+void frameChunk(std::vector<uint8_t>& chunk, size_t offset) {
+    size_t size = chunk.size() - offset;
+    std::vector<uint8_t> frame;
+    if (compress(chunk.data() + offset, size, frame)) {
+        chunk.resize(offset);
+        chunk.insert(chunk.end(), frame.begin(), frame.end());
+        return;
+    }
+
+    chunk.insert(chunk.begin() + offset, FRAME_HEADER_SIZE, 0);
+    writeFrameHeader(chunk.data() + offset, CODEC_NONE, size);
+}
+
+void unframeChunk(std::vector<uint8_t>& chunk, size_t offset) {
+    size_t size = chunk.size() - offset;
+    if (size < FRAME_HEADER_SIZE) {
+        throw std::runtime_error("Invalid compressed file chunk");
+    }
+
+    const uint8_t* frame = chunk.data() + offset;
+    size_t original = originalSize(frame);
+    // Checked here too, since decompress allows far more than one chunk
+    if (original > FILE_CHUNK_SIZE) {
+        throw std::runtime_error("Compressed file chunk is too large");
+    }
+
+    if (frame[0] == CODEC_NONE) {
+        if (original != size - FRAME_HEADER_SIZE) {
+            throw std::runtime_error("Corrupt compressed file chunk");
+        }
+        chunk.erase(chunk.begin() + offset, chunk.begin() + offset + FRAME_HEADER_SIZE);
+        return;
+    }
+
+    std::vector<uint8_t> data = decompress(frame, size);
+    chunk.resize(offset);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+}
+
+bool isCompressedType(uint8_t msg_type) {
+    return msg_type == MSG_TYPE_TEXT_COMPRESSED || msg_type == MSG_TYPE_FILE_COMPRESSED;
+}
+
+uint8_t baseType(uint8_t msg_type) {
+    switch (msg_type) {
+        case MSG_TYPE_TEXT_COMPRESSED: return MSG_TYPE_TEXT_MESSAGE;
+        case MSG_TYPE_FILE_COMPRESSED: return MSG_TYPE_FILE;
+        default: return msg_type;
+    }
+}
+
+std::vector<uint8_t> encryptContent(AESWrapper& aes, uint8_t& msg_type, const uint8_t* data, size_t size) {
+    std::vector<uint8_t> frame;
+    if (compress(data, size, frame)) {
+        msg_type = msg_type == MSG_TYPE_FILE ? MSG_TYPE_FILE_COMPRESSED : MSG_TYPE_TEXT_COMPRESSED;
+        aes.encryptInPlace(frame);
+        return frame;
+    }
+
+    std::vector<uint8_t> ciphertext(AESWrapper::ciphertextSize(size));
+    aes.encrypt(data, size, ciphertext.data());
+    return ciphertext;
+}
+
+std::vector<uint8_t> decryptContent(AESWrapper& aes, uint8_t msg_type, const std::vector<uint8_t>& content) {
+    std::vector<uint8_t> plaintext = aes.decrypt(content);
+    if (!isCompressedType(msg_type)) {
+        return plaintext;
+    }
+    return decompress(plaintext.data(), plaintext.size());
+}
+
+} // namespace compression
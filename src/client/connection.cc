@@ -0,0 +1,206 @@
+#include "connection.h"
+#include "instrument.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+
+constexpr int Connection::MAX_CONNECT_ATTEMPTS;
+constexpr int Connection::INITIAL_BACKOFF_MS;
+
+Connection::Connection() : port(0), sock(-1), stats{0, 0, 0}, quiet(false) {}
+
+Connection::~Connection() {
+    close();
+}
+
+void Connection::setEndpoint(const std::string& host, int port) {
+    close();
+    this->host = host;
+    this->port = port;
+}
+
+bool Connection::open() {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_CONNECT);
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        std::cerr << "Failed to create socket" << std::endl;
+        return false;
+    }
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0) {
+        std::cerr << "Invalid address" << std::endl;
+        close();
+        return false;
+    }
+
+    if (::connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        close();
+        return false;
+    }
+
+    // Requests are small and latency-bound; don't let Nagle hold back the header
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    return true;
+}
+
+bool Connection::acquire() {
+    if (sock >= 0) {
+        if (isAlive()) {
+            stats.reused++;
+            return true;
+        }
+        close();
+    }
+
+    int backoff_ms = INITIAL_BACKOFF_MS;
+    for (int attempt = 1; attempt <= MAX_CONNECT_ATTEMPTS; attempt++) {
+        if (open()) {
+            stats.opened++;
+            if (!quiet) {
+                std::cout << "Connected to server" << std::endl;
+            }
+            return true;
+        }
+
+        stats.failed_attempts++;
+        if (attempt < MAX_CONNECT_ATTEMPTS) {
+            std::cerr << "Connection failed, retrying in " << backoff_ms << " ms" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+            backoff_ms *= 2;
+        }
+    }
+
+    std::cerr << "Connection failed" << std::endl;
+    return false;
+}
+
+bool Connection::isAlive() const {
+    if (sock < 0) {
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready = poll(&pfd, 1, 0);
+    if (ready < 0) {
+        return false;
+    }
+    if (ready == 0) {
+        return true;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return false;
+    }
+
+    // Readable while idle means either EOF or stray bytes - both leave the stream unusable
+    uint8_t probe;
+    ssize_t n = recv(sock, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    return false;
+}
+
+void Connection::close() {
+    if (sock >= 0) {
+        ::close(sock);
+        sock = -1;
+    }
+}
+
+bool Connection::sendAll(const uint8_t* data, size_t length) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_SEND);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    size_t total = 0;
+    while (total < length) {
+        // MSG_NOSIGNAL: a peer that went away must not kill the process with SIGPIPE
+        ssize_t sent = send(sock, data + total, length - total, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        total += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool Connection::sendGather(const uint8_t* prefix, size_t prefix_length,
+                            const uint8_t* body, size_t body_length) {
+    INSTRUMENT_TIMER(timer, instrument::PHASE_SEND);
+    INSTRUMENT_ADD_BYTES(timer, prefix_length + body_length);
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<uint8_t*>(prefix);
+    iov[0].iov_len = prefix_length;
+    iov[1].iov_base = const_cast<uint8_t*>(body);
+    iov[1].iov_len = body_length;
+    
+    struct iovec* pending = iov;
+    int pending_count = body_length > 0 ? 2 : 1;
+    
+    while (pending_count > 0) {
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = pending;
+        msg.msg_iovlen = pending_count;
+        
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        
+        // Skip fully written buffers and trim the partially written one
+        size_t remaining = static_cast<size_t>(sent);
+        while (pending_count > 0 && remaining >= pending->iov_len) {
+            remaining -= pending->iov_len;
+            pending++;
+            pending_count--;
+        }
+        if (pending_count > 0) {
+            pending->iov_base = static_cast<uint8_t*>(pending->iov_base) + remaining;
+            pending->iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool Connection::recvAll(uint8_t* data, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+        ssize_t received = recv(sock, data + total, length - total, MSG_WAITALL);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (received == 0) {
+            return false;
+        }
+        total += static_cast<size_t>(received);
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+#include "connection_pool.h"
+
+#include <algorithm>
+
+constexpr size_t ConnectionPool::DEFAULT_MAX_CONNECTIONS;
+
+ConnectionPool::Lease::Lease(Lease&& other)
+    : pool(other.pool), connection(other.connection), slot(other.slot) {
+    other.pool = nullptr;
+    other.connection = nullptr;
+}
+
+ConnectionPool::Lease& ConnectionPool::Lease::operator=(Lease&& other) {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        connection = other.connection;
+        slot = other.slot;
+        other.pool = nullptr;
+        other.connection = nullptr;
+    }
+    return *this;
+}
+
+void ConnectionPool::Lease::release() {
+    if (connection) {
+        pool->checkin(slot);
+        pool = nullptr;
+        connection = nullptr;
+    }
+}
+
+ConnectionPool::ConnectionPool(size_t max_connections)
+    : max_connections(std::max<size_t>(max_connections, 1)), port(0), quiet(false) {}
+
+void ConnectionPool::setEndpoint(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->host = host;
+    this->port = port;
+    for (auto& slot : slots) {
+        slot.connection->setEndpoint(host, port);
+    }
+}
+
+void ConnectionPool::setQuiet(bool quiet) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->quiet = quiet;
+    for (auto& slot : slots) {
+        slot.connection->setQuiet(quiet);
+    }
+}
+
+void ConnectionPool::setMaxConnections(size_t max_connections) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->max_connections = std::max<size_t>(max_connections, 1);
+}
+
+size_t ConnectionPool::maxConnections() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_connections;
+}
+
+ConnectionPool::Lease ConnectionPool::take() {
+    // An open connection saves the next holder a handshake
+    size_t idle = slots.size();
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (slots[i].leased) {
+            continue;
+        }
+        if (slots[i].connection->isOpen()) {
+            idle = i;
+            break;
+        }
+        if (idle == slots.size()) {
+            idle = i;
+        }
+    }
+
+    if (idle == slots.size()) {
+        if (slots.size() >= max_connections) {
+            return Lease();
+        }
+        Slot slot;
+        slot.connection.reset(new Connection());
+        slot.connection->setEndpoint(host, port);
+        slot.connection->setQuiet(quiet);
+        slot.returned_stats = slot.connection->getStats();
+        slot.leased = false;
+        slots.push_back(std::move(slot));
+    }
+
+    slots[idle].leased = true;
+    return Lease(this, slots[idle].connection.get(), idle);
+}
+
+ConnectionPool::Lease ConnectionPool::checkout() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        Lease lease = take();
+        if (lease) {
+            return lease;
+        }
+        returned.wait(lock);
+    }
+}
+
+ConnectionPool::Lease ConnectionPool::tryCheckout() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return take();
+}
+
+void ConnectionPool::checkin(size_t slot) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[slot].returned_stats = slots[slot].connection->getStats();
+        slots[slot].leased = false;
+    }
+    returned.notify_one();
+}
+
+std::vector<ConnectionStats> ConnectionPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ConnectionStats> result;
+    result.reserve(slots.size());
+    for (const auto& slot : slots) {
+        result.push_back(slot.leased ? slot.returned_stats : slot.connection->getStats());
+    }
+    return result;
+}
@@ -0,0 +1,43 @@
+#include "directory.h"
+#include "protocol.h"
+
+ClientDirectory::ClientDirectory() : cursor(0) {}
+
+const ClientInfo* ClientDirectory::findByName(const std::string& name) const {
+    auto it = by_name.find(name);
+    if (it == by_name.end()) {
+        return nullptr;
+    }
+    return &clients[it->second];
+}
+
+const ClientInfo* ClientDirectory::findById(const uint8_t* client_id) const {
+    std::string key(reinterpret_cast<const char*>(client_id), CLIENT_ID_SIZE);
+    auto it = by_id.find(key);
+    if (it == by_id.end()) {
+        return nullptr;
+    }
+    return &clients[it->second];
+}
+
+void ClientDirectory::add(const ClientInfo& client) {
+    std::string id_key(reinterpret_cast<const char*>(client.id), CLIENT_ID_SIZE);
+    if (by_id.count(id_key)) {
+        return;
+    }
+    
+    size_t index = clients.size();
+    clients.push_back(client);
+    by_name[client.name] = index;
+    by_id[id_key] = index;
+}
+
+void ClientDirectory::merge(const std::vector<ClientInfo>& new_clients, uint32_t new_cursor) {
+    for (const auto& client : new_clients) {
+        add(client);
+    }
+    
+    if (new_cursor > cursor) {
+        cursor = new_cursor;
+    }
+}
@@ -0,0 +1,166 @@
+#include "event_loop.h"
+
+#include <stdexcept>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static constexpr int MAX_EVENTS = 64;
+
+EventLoop::EventLoop() : epoll_fd(-1), wake_fd(-1), running(false) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        ::close(epoll_fd);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    // Registered directly: the loop thread isn't running yet
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    ::close(wake_fd);
+    ::close(epoll_fd);
+}
+
+void EventLoop::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    thread = std::thread(&EventLoop::run, this);
+}
+
+void EventLoop::stop() {
+    if (running) {
+        post([this]() { running = false; });
+    }
+    // A callback can't join its own thread; the loop ends once it returns,
+    // and the next stop() from another thread (the destructor's at the
+    // latest) joins it
+    if (inLoopThread() || !thread.joinable()) {
+        return;
+    }
+    thread.join();
+}
+
+void EventLoop::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        tasks.push_back(std::move(task));
+    }
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+}
+
+bool EventLoop::inLoopThread() const {
+    return std::this_thread::get_id() == thread.get_id();
+}
+
+void EventLoop::watch(int fd, uint32_t events, IoCallback callback) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        throw std::runtime_error("Failed to watch file descriptor");
+    }
+    callbacks[fd] = std::move(callback);
+}
+
+void EventLoop::modify(int fd, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EventLoop::unwatch(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    callbacks.erase(fd);
+}
+
+int EventLoop::addTimer(unsigned interval_ms, Task task) {
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        throw std::runtime_error("Failed to create timer");
+    }
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+
+    watch(timer_fd, EPOLLIN, [timer_fd, task](uint32_t) {
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+            task();
+        }
+    });
+    return timer_fd;
+}
+
+void EventLoop::cancelTimer(int timer_id) {
+    unwatch(timer_id);
+    ::close(timer_id);
+}
+
+void EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t value;
+                ssize_t drained = read(wake_fd, &value, sizeof(value));
+                (void)drained;
+                runPostedTasks();
+                continue;
+            }
+
+            // An earlier callback in this batch may have unwatched fd. Call a
+            // copy, since the callback may also unwatch itself.
+            auto it = callbacks.find(fd);
+            if (it == callbacks.end()) {
+                continue;
+            }
+            IoCallback callback = it->second;
+            callback(events[i].events);
+        }
+    }
+
+    // Tasks posted before stop() still run, e.g. to close sockets
+    runPostedTasks();
+}
+
+void EventLoop::runPostedTasks() {
+    std::vector<Task> ready;
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        ready.swap(tasks);
+    }
+    for (auto& task : ready) {
+        task();
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+class EventLoop;
+
+// Non-blocking counterpart of Connection + RequestPipeline, driven by an
+// EventLoop. Requests are queued and written as the socket accepts them;
+// responses are parsed incrementally and matched to requests in order. The
+// socket is opened on the first submit() and again after a failure.
+//
+// All methods must be called on the loop thread.
+class AsyncConnection {
+public:
+    // ok is false when the connection failed before the response arrived; the
+    // header is then zeroed and the payload empty
+    typedef std::function<void(bool ok, const ResponseHeader& header, std::vector<uint8_t>& payload)> Handler;
+
+    AsyncConnection(EventLoop& loop, const std::string& host, int port);
+    ~AsyncConnection();
+
+    AsyncConnection(const AsyncConnection&) = delete;
+    AsyncConnection& operator=(const AsyncConnection&) = delete;
+
+    void submit(std::vector<uint8_t> request, Handler handler);
+    // Fails every outstanding request and closes the socket
+    void close();
+
+    size_t inFlight() const { return pending.size(); }
+
+private:
+    enum class State { Closed, Connecting, Open };
+
+    EventLoop& loop;
+    std::string host;
+    int port;
+    int sock;
+    State state;
+
+    // Requests not yet fully written; the front one is written from output_offset
+    std::deque<std::vector<uint8_t>> output;
+    size_t output_offset;
+    // One handler per request submitted and not yet answered
+    std::deque<Handler> pending;
+
+    uint8_t header_buffer[7];
+    size_t header_read;
+    ResponseHeader header;
+    std::vector<uint8_t> payload;
+    size_t payload_read;
+    bool reading_payload;
+
+    void open();
+    void onEvents(uint32_t events);
+    void finishConnect();
+    void writeOutput();
+    void readInput();
+    void deliver();
+    void updateInterest();
+    void fail();
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+#include "protocol.h"
+#include "message.h"
+#include "event_loop.h"
+#include "async_connection.h"
+
+class WorkerPool;
+
+// File transfers and mailbox polling that run on an EventLoop thread over
+// their own connection, so the menu stays usable while they progress. Each job
+// is a small state machine advanced by response callbacks; none of them touch
+// MessageUClient state, so everything they need is copied in when they start.
+class BackgroundTasks {
+public:
+    enum class JobState { Running, Done, Failed };
+
+    struct JobStatus {
+        std::string description;
+        uint32_t chunks_done;
+        uint32_t chunk_count;
+        JobState state;
+        std::string detail;
+    };
+
+    // Chunks are encrypted and decrypted on crypto_pool, which must outlive this
+    BackgroundTasks(const std::string& host, int port, WorkerPool& crypto_pool);
+    // Abandons unfinished jobs; call waitIdle() first to let them complete
+    ~BackgroundTasks();
+
+    BackgroundTasks(const BackgroundTasks&) = delete;
+    BackgroundTasks& operator=(const BackgroundTasks&) = delete;
+
+    // Sends path to target as a chunked file encrypted with key
+    void upload(const uint8_t* from_id, const uint8_t* target_id, const std::string& target_name,
+                const std::string& path, const std::vector<uint8_t>& key);
+    // Fetches the chunks of a chunked file message (either framing) into path
+    void download(const uint8_t* client_id, const Message& msg, const std::string& sender_name,
+                  const std::vector<uint8_t>& key, const std::string& path);
+
+    // Fetches a page of waiting messages every interval_seconds into the
+    // inbox. They stay on the server until the fetch that shows them
+    // acknowledges them.
+    void startPolling(const uint8_t* client_id, unsigned interval_seconds);
+    // Instead of polling, keeps a REQ_WAIT_MESSAGES request open so new
+    // messages reach the inbox as soon as the server stores them. Pauses
+    // while the inbox holds a page's worth, until it is taken.
+    void startReceiving(const uint8_t* client_id);
+    bool isPolling() const { return polling; }
+    // Messages the poller fetched since the last call, oldest first
+    std::vector<Message> takeInbox();
+    // Messages up to through_id were shown and acknowledged elsewhere; the
+    // poller drops them if it fetched them meanwhile and continues after them
+    void acknowledged(uint32_t through_id);
+    // Lets the server delete messages up to through_id, which also deletes
+    // the chunks of chunked files among them. The acknowledgement is held
+    // back before any of those files still downloading, and for the rest of
+    // the session before one whose download failed, so it is offered again.
+    void acknowledge(const uint8_t* client_id, uint32_t through_id);
+
+    std::map<uint32_t, JobStatus> jobs() const;
+    size_t activeJobs() const;
+    // Blocks until no upload, download or acknowledgement is in flight
+    void waitIdle();
+
+private:
+    struct Upload;
+    struct Download;
+
+    EventLoop loop;
+    AsyncConnection connection;
+    // Held wait requests only, so they don't stall transfers queued behind them
+    AsyncConnection wait_connection;
+    WorkerPool& crypto_pool;
+
+    mutable std::mutex mutex;
+    std::condition_variable idle;
+    std::map<uint32_t, JobStatus> statuses;
+    uint32_t next_job_id;
+    size_t active;
+    size_t acks_in_flight;
+    std::vector<Message> inbox;
+    // Highest message ID fetched into the inbox or acknowledged
+    uint32_t poll_cursor;
+
+    std::atomic<bool> polling;
+    // Loop thread only
+    bool poll_in_flight;
+    int poll_timer;
+    uint8_t poll_client_id[CLIENT_ID_SIZE];
+    bool receiving;
+    bool wait_in_flight;
+    // Retries a failed wait request; running only while the server is unreachable
+    int wait_retry_timer;
+    uint8_t ack_client_id[CLIENT_ID_SIZE];
+    // Highest ID acknowledge() was asked for, and the highest sent
+    uint32_t ack_wanted;
+    uint32_t ack_sent;
+    // Message IDs of chunked files still downloading
+    std::set<uint32_t> downloading;
+    // Lowest message ID whose download failed, 0 if none has
+    uint32_t failed_download;
+
+    uint32_t addJob(const std::string& description);
+    void updateJob(uint32_t job_id, uint32_t chunks_done, uint32_t chunk_count);
+    void finishJob(uint32_t job_id, bool ok, const std::string& detail);
+
+    void pumpUpload(const std::shared_ptr<Upload>& job);
+    void pumpDownload(const std::shared_ptr<Download>& job);
+    // Call before finishJob(), so waitIdle() also covers the acknowledgement
+    void downloadFinished(uint32_t message_id, bool ok);
+    // Sends as much of ack_wanted as the downloads allow
+    void sendAcknowledgement();
+    void poll();
+    void waitForMessages();
+    // Adds a RES_MESSAGE_PAGE to the inbox; false if the request failed
+    bool acceptPage(bool ok, const ResponseHeader& header, std::vector<uint8_t>& payload);
+    // Caller holds mutex
+    bool inboxFull() const;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+class AESWrapper;
+class WorkerPool;
+
+// Encrypts and decrypts batches of file chunks on a WorkerPool. Chunks use
+// AESWrapper's framed form, each with its own IV, so unlike one CBC stream
+// over the whole file they can go to as many threads as there are chunks.
+//
+// Every chunk buffer holds its framed form from offset on: the IV, then the
+// data. Encryption expects the plaintext after the IV's room and decryption
+// leaves it there; the buffer is resized to fit either way. offset leaves
+// space in front for whatever the chunk is sent or received in.
+//
+// A compressed cipher (MSG_TYPE_FILE_CHUNKED_COMPRESSED) also frames each
+// chunk with compression::frameChunk before encrypting it and unframes it
+// after decrypting, on the same lane.
+class ChunkCipher {
+public:
+    ChunkCipher(WorkerPool& pool, const std::vector<uint8_t>& key, bool compressed);
+    ~ChunkCipher();
+
+    ChunkCipher(const ChunkCipher&) = delete;
+    ChunkCipher& operator=(const ChunkCipher&) = delete;
+
+    // Chunks worth reading before handing them to the pool at once
+    size_t batchSize() const { return lanes.size() * 2; }
+
+    void encrypt(std::vector<std::vector<uint8_t>>& chunks, size_t offset);
+    // Throws if any chunk doesn't decrypt (or inflate)
+    void decrypt(std::vector<std::vector<uint8_t>>& chunks, size_t offset);
+
+private:
+    WorkerPool& pool;
+    bool compressed;
+    // One cipher per pool thread; a lane handles every lanes.size()-th chunk
+    // of a batch, so no cipher is ever used by two threads at once
+    std::vector<std::unique_ptr<AESWrapper>> lanes;
+
+    void run(std::vector<std::vector<uint8_t>>& chunks, size_t offset, bool encrypting);
+};
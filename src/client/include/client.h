@@ -3,28 +3,73 @@
 
 #include <string>
 #include <vector>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <iosfwd>
 #include <cstdint>
 
 #include "protocol.h"
+#include "connection.h"
+#include "connection_pool.h"
+#include "directory.h"
+#include "keycache.h"
+#include "keystore.h"
 
 class RSAPrivateWrapper;
+class AESWrapper;
+class MailboxReader;
+class BackgroundTasks;
+class WorkerPool;
+struct Message;
 
 constexpr const char* SERVER_INFO_FILE = "server.info";
 constexpr const char* MY_INFO_FILE = "my.info";
 
 class MessageUClient {
+    // Drives the same operations as the menu from a script
+    friend class ScriptRunner;
+    
 private:
     std::string server_ip;
     int server_port;
-    int sock;
+    // The session's connection is checked out for the client's lifetime;
+    // independent operations (script uploads, chunked downloads) lease others
+    ConnectionPool connections;
+    ConnectionPool::Lease session;
+    Connection& connection;
     uint8_t client_id[CLIENT_ID_SIZE];
     std::string username;
     RSAPrivateWrapper* rsa_private;
     bool registered;
+    // Keep one socket open across menu actions instead of reconnecting per action
+    bool persistent;
+    
+    ClientDirectory directory;
+    // Encrypted messages waiting for the next flushOutbox()
+    std::vector<OutgoingMessage> outbox;
+    // Peer public keys from lookups and REQ_PUBLIC_KEY, persisted across runs
+    PublicKeyCache public_key_cache;
+    // Threads encrypting and decrypting file chunks and fetched messages;
+    // 0 is one per core. With 1, a fetch decrypts on the main thread as
+    // messages stream in.
+    unsigned crypto_threads;
+    // Started on first use; declared before background, whose jobs use it
+    std::unique_ptr<WorkerPool> crypto_pool;
+    // Interactive mode only: large transfers and polling on an event loop thread
+    std::unique_ptr<BackgroundTasks> background;
+    // Seconds between background mailbox polls; 0 disables polling
+    unsigned poll_interval;
+    // Receive new messages through a held REQ_WAIT_MESSAGES instead of polling
+    bool push_receive;
+    // Highest message ID shown by option 140; a fetch continues after it
+    uint32_t shown_through;
+    // rsa_private shares one RNG between decrypts
+    std::mutex rsa_mutex;
     
-    // Maps client_id (as hex string) to their AES key for encrypted communication
-    std::map<std::string, std::vector<uint8_t>> symmetric_keys;
+    // Peer AES keys by raw client ID, with a ready-keyed cipher per peer;
+    // saved to SYMMETRIC_KEYS_FILE once we have an identity
+    SymmetricKeyStore symmetric_keys;
     
     void loadServerInfo();
     // Returns false if no prior session exists (first-time user)
@@ -32,32 +77,159 @@ private:
     void saveMyInfo();
     bool connect();
     void disconnect();
+    // End of an action: closes the socket only when not in persistent mode
+    void releaseConnection();
     // Handles partial writes in case socket buffer is full
     bool sendRequest(const std::vector<uint8_t>& request);
+    // Sends a request whose payload ends in content without copying the content
+    bool sendRequest(const uint8_t* prefix, size_t prefix_size, const std::vector<uint8_t>& content);
+    bool sendMessageRequest(const uint8_t* target_id, uint8_t msg_type, const std::vector<uint8_t>& content);
+    // Reads the 7-byte header; throws on RES_GENERAL_ERROR
+    ResponseHeader receiveResponseHeader();
     // Blocks until entire response (header + payload) is received
     std::vector<uint8_t> receiveResponse();
     
+    // Pulls clients registered since the last refresh into the directory
+    void refreshDirectory();
+    // Resolves uncached names (and their public keys) in a single lookup request
+    void lookupClients(const std::vector<std::string>& names);
+    // Cached name lookup; falls back to a one-name lookup request on a miss
+    bool resolveClient(const std::string& name, uint8_t* target_id);
+    // Served from the key cache when possible; fetches and caches otherwise
+    const std::vector<uint8_t>& fetchPublicKey(const uint8_t* target_id);
+    
     bool hasSymmetricKey(const uint8_t* target_id);
     void saveSymmetricKey(const uint8_t* target_id, const std::vector<uint8_t>& key);
+    // A copy of the key, for work handed to another thread
     std::vector<uint8_t> getSymmetricKey(const uint8_t* target_id);
+    // The cached cipher for this peer; throws if there is no key
+    AESWrapper& symmetricCipher(const uint8_t* target_id);
     
+    // Generates a key pair, registers name and saves my.info; false if the
+    // server gave no client ID
+    bool registerAs(const std::string& name);
     void registerClient();
     void requestClientList();
     void requestPublicKey();
+    // Fetches the mailbox a page at a time, acknowledging each page once shown
     void requestWaitingMessages();
+    // Reads the mailbox a page at a time after cursor, for the menu and the
+    // script alike. read_page consumes a page, setting aside the messages
+    // that need further requests (see holdUntilPageEnd()); once the page has
+    // been read, the directory is refreshed if any of them is from a sender
+    // it lacks, and finish_page handles them in mailbox order, given the
+    // page's last ID. It returns the ID the page can be acknowledged through;
+    // acked is advanced as pages are acknowledged.
+    void readMailbox(uint32_t cursor, uint32_t& acked,
+                     const std::function<void(MailboxReader&, std::vector<Message>&)>& read_page,
+                     const std::function<uint32_t(const std::vector<Message>&, uint32_t)>& finish_page);
+    // Chunked files, whose chunks are fetched with requests of their own, and
+    // messages from senders not in the directory yet, whose names are. No
+    // request can go out while a page is streaming.
+    bool holdUntilPageEnd(const Message& msg) const;
+    // A read_page step that hands over one message at a time, with its content
+    // read unless it is a MSG_TYPE_FILE, which handle streams from the mailbox;
+    // returns the number of messages, held ones included
+    size_t readPage(MailboxReader& mailbox, std::vector<Message>& held,
+                    const std::function<void(const Message&, MailboxReader&)>& handle);
+    // Sends REQ_MESSAGE_PAGE for the messages after after_id and reads the
+    // response's "more pages" byte; returns the size of the records that follow
+    uint32_t requestMessagePage(uint32_t after_id, bool& more);
+    // Lets the server delete our messages up to through_id
+    void acknowledgeMessages(uint32_t through_id);
+    // A message decrypted ahead of time by the decrypt pool
+    struct PreparedMessage;
+    // Reads the rest of the mailbox, decrypting on crypto_pool and printing
+    // in mailbox order, held messages aside; returns the number of messages
+    size_t displayInParallel(std::vector<Message> polled, MailboxReader& mailbox,
+                             std::vector<Message>& held);
+    // Runs on a decrypt worker: decrypts the content and saves files
+    void prepareMessage(PreparedMessage& prepared);
+    // RSA-decrypts a MSG_TYPE_SYM_KEY_SEND payload; safe from any thread
+    std::vector<uint8_t> unwrapSymmetricKey(const std::vector<uint8_t>& wrapped);
+    std::string senderName(const uint8_t* sender_id) const;
+    // Where a received file is written: $TMP (or $TEMP, /tmp)/received_<id>.bin
+    static std::string receivedFilePath(uint32_t message_id);
+    // What decoding a waiting message came to; the menu and the script print
+    // it in their own formats
+    struct ReceivedMessage {
+        // No key from the sender, so the content was left encrypted
+        bool no_key = false;
+        // Empty unless decrypting the content or unwrapping the key failed
+        std::string error;
+        // Decrypted text, or the key from a key send
+        std::vector<uint8_t> plaintext;
+        // Files only
+        std::string filename;
+        uint64_t written = 0;
+        bool saved = false;
+    };
+    // Decrypts any waiting message but a chunked file, saving received keys
+    // and files. mailbox is used to stream the content of MSG_TYPE_FILE
+    // messages that haven't been read yet. With prepared, the decrypt pool's
+    // result is taken instead.
+    ReceivedMessage decodeMessage(const Message& msg, MailboxReader* mailbox,
+                                  const PreparedMessage* prepared = nullptr);
+    // Prints and processes one waiting message, as decodeMessage does
+    void displayMessage(const Message& msg, MailboxReader* mailbox,
+                        const PreparedMessage* prepared = nullptr);
+    // Decrypts a file's content block by block from the mailbox to disk
+    bool receiveFileContent(const Message& msg, MailboxReader& mailbox,
+                            const std::string& filename, uint64_t* written);
     void sendTextMessage();
     // Asks recipient to send us their AES key (encrypted with our RSA public key)
     void requestSymmetricKey();
     // Encrypts our AES key with recipient's RSA public key and sends it
     void sendSymmetricKey();
     void sendFile();
+    // Sends one text to several recipients in a single REQ_SEND_BATCH
+    void sendTextBatch();
+    void queueMessage(const uint8_t* target_id, uint8_t msg_type, const std::vector<uint8_t>& content);
+    // Sends everything queued in as few batch requests as the limits allow,
+    // pipelined, and returns the message IDs in queue order (0 for rejected records).
+    // The outbox is always empty afterwards. If the flush stops part way, the
+    // records not yet acknowledged get 0 too and failure says why; otherwise
+    // failure is left empty.
+    std::vector<uint32_t> flushOutbox(std::string& failure);
+    // Reads and encrypts a batch of chunks at a time on crypto_pool, so memory
+    // use doesn't grow with the file, and sends them over conn with up to
+    // FILE_CHUNK_WINDOW chunks awaiting their ack; returns the number of
+    // encrypted bytes sent. Safe off the main thread once crypto_pool exists.
+    uint64_t sendFileChunks(Connection& conn, const uint8_t* target_id, std::istream& file,
+                            uint64_t file_size, const std::vector<uint8_t>& key);
+    // Fetches each chunk of a chunked file message over a pipeline on
+    // conn, decrypting a batch at a time on crypto_pool and writing in order
+    bool receiveFileChunks(Connection& conn, const Message& msg, const std::vector<uint8_t>& key,
+                           const std::string& filename, uint64_t* written);
+    WorkerPool& cryptoPool();
+    // Started on first use, with its own connection to the server
+    BackgroundTasks& backgroundTasks();
+    void startPolling();
+    void showBackgroundJobs();
     void showMenu();
+    // Counters per pooled connection, the session's live
+    std::vector<ConnectionStats> connectionStats() const;
+    void printConnectionStats() const;
     
 public:
-    MessageUClient();
+    explicit MessageUClient(bool persistent = true);
     ~MessageUClient();
     
+    // Polls the mailbox in the background during run(); 0 (the default) disables it
+    void setPollInterval(unsigned seconds) { poll_interval = seconds; }
+    // Receives new messages in the background as the server stores them,
+    // through a request it holds open; takes precedence over polling
+    void setPushReceive(bool enabled) { push_receive = enabled; }
+    // Threads for chunk and message crypto; 0 (the default) is one per core
+    void setCryptoThreads(unsigned threads) { crypto_threads = threads; }
+    // Connections to the server, the session's included; the default is
+    // ConnectionPool::DEFAULT_MAX_CONNECTIONS
+    void setMaxConnections(size_t count) { connections.setMaxConnections(count); }
     void run();
+    // Headless mode: executes script commands from in over one session and
+    // writes one result line per command to out (see script.h). Returns the
+    // number of commands that failed.
+    size_t runScript(std::istream& in, std::ostream& out);
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class AESWrapper;
+
+// Optional compression of text and file content before it is encrypted.
+// The codec is picked at build time (make COMPRESS=zlib|zstd|lz4); a build
+// without one sends everything as it is but can still tell compressed
+// messages apart by their type.
+//
+// Compressed content, before encryption, is framed as
+//
+//   codec (1) | original size (4, LE) | compressed bytes
+//
+// and sent as MSG_TYPE_TEXT_COMPRESSED / MSG_TYPE_FILE_COMPRESSED. Each
+// chunk of a MSG_TYPE_FILE_CHUNKED_COMPRESSED file is framed the same way on
+// its own, with CODEC_NONE for a chunk kept as it is.
+namespace compression {
+
+enum Codec : uint8_t {
+    CODEC_NONE = 0,
+    CODEC_ZLIB = 1,
+    CODEC_ZSTD = 2,
+    CODEC_LZ4 = 3
+};
+
+// Content shorter than this isn't worth the frame and the CPU time
+constexpr size_t MIN_SIZE = 512;
+// Refuses to inflate a frame claiming more than this
+constexpr size_t MAX_ORIGINAL_SIZE = 256 * 1024 * 1024;
+constexpr size_t FRAME_HEADER_SIZE = 5;
+
+// The codec compiled in, or CODEC_NONE
+Codec builtIn();
+const char* codecName(Codec codec);
+
+// Frames data compressed with the built-in codec into out. Returns false,
+// leaving out untouched, when data is too small, there is no codec or the
+// frame wouldn't be smaller than data.
+bool compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+// Throws on a damaged frame or one from a codec this build doesn't have
+std::vector<uint8_t> decompress(const uint8_t* frame, size_t size);
+
+// Replaces the bytes of chunk from offset on with their frame: compressed if
+// that pays off, otherwise stored under CODEC_NONE
+void frameChunk(std::vector<uint8_t>& chunk, size_t offset);
+// Reverses frameChunk; throws on a damaged frame or one that would inflate
+// past FILE_CHUNK_SIZE
+void unframeChunk(std::vector<uint8_t>& chunk, size_t offset);
+
+bool isCompressedType(uint8_t msg_type);
+// MSG_TYPE_TEXT_MESSAGE or MSG_TYPE_FILE for either form of them; other
+// types are returned as they are
+uint8_t baseType(uint8_t msg_type);
+
+// Content of a text or file message: compressed when that pays off, then
+// encrypted. msg_type is switched to the compressed type if it was.
+std::vector<uint8_t> encryptContent(AESWrapper& aes, uint8_t& msg_type, const uint8_t* data, size_t size);
+// Reverses encryptContent for a message of msg_type
+std::vector<uint8_t> decryptContent(AESWrapper& aes, uint8_t msg_type, const std::vector<uint8_t>& content);
+
+} // namespace compression
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+struct ConnectionStats {
+    uint64_t opened;
+    uint64_t reused;
+    uint64_t failed_attempts;
+};
+
+// Long-lived TCP connection to the server. The server loops over requests on
+// one socket, so a single connection can serve many menu actions.
+class Connection {
+private:
+    std::string host;
+    int port;
+    int sock;
+    ConnectionStats stats;
+    // Suppresses the progress message on connect (scripted runs)
+    bool quiet;
+
+    bool open();
+
+public:
+    static constexpr int MAX_CONNECT_ATTEMPTS = 5;
+    static constexpr int INITIAL_BACKOFF_MS = 100;
+
+    Connection();
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    void setEndpoint(const std::string& host, int port);
+    void setQuiet(bool quiet) { this->quiet = quiet; }
+
+    // Reuses the open socket if the server still holds it, otherwise reconnects
+    // with exponential backoff. Returns false once all attempts are exhausted.
+    bool acquire();
+    // Non-blocking peek: a closed, errored or unexpectedly readable socket is dead
+    bool isAlive() const;
+    void close();
+
+    bool sendAll(const uint8_t* data, size_t length);
+    // Sends prefix then body as one request with sendmsg, without joining them
+    bool sendGather(const uint8_t* prefix, size_t prefix_length,
+                    const uint8_t* body, size_t body_length);
+    bool recvAll(uint8_t* data, size_t length);
+
+    bool isOpen() const { return sock >= 0; }
+    int fd() const { return sock; }
+    const ConnectionStats& getStats() const { return stats; }
+};
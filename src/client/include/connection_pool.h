@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+#include "connection.h"
+
+// A few persistent connections to the server, handed out one holder at a
+// time. The server serves each socket's requests in order, so operations that
+// shouldn't wait for each other (an upload and a mailbox fetch) each check out
+// their own connection and run side by side.
+class ConnectionPool {
+public:
+    static constexpr size_t DEFAULT_MAX_CONNECTIONS = 4;
+
+    // Exclusive use of one pooled connection until it is destroyed or released.
+    // The connection is returned as it is: still open for the next holder, or
+    // closed if the holder closed it after a failure.
+    class Lease {
+    public:
+        Lease() : pool(nullptr), connection(nullptr), slot(0) {}
+        Lease(Lease&& other);
+        Lease& operator=(Lease&& other);
+        ~Lease() { release(); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        void release();
+
+        explicit operator bool() const { return connection != nullptr; }
+        Connection& operator*() const { return *connection; }
+        Connection* operator->() const { return connection; }
+        // Position of the connection in stats()
+        size_t index() const { return slot; }
+
+    private:
+        friend class ConnectionPool;
+
+        ConnectionPool* pool;
+        Connection* connection;
+        size_t slot;
+
+        Lease(ConnectionPool* pool, Connection* connection, size_t slot)
+            : pool(pool), connection(connection), slot(slot) {}
+    };
+
+    // Every lease must be returned before the pool is destroyed
+    explicit ConnectionPool(size_t max_connections = DEFAULT_MAX_CONNECTIONS);
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Apply to connections already created too; call them while no lease is
+    // held on another thread
+    void setEndpoint(const std::string& host, int port);
+    void setQuiet(bool quiet);
+    // Takes effect for later checkouts; at least 1
+    void setMaxConnections(size_t max_connections);
+
+    // Hands out an idle connection, preferring one that is still open, or
+    // creates one while under the limit; otherwise blocks until a lease is
+    // returned. The holder opens it with acquire() as with any Connection.
+    Lease checkout();
+    // Like checkout(), but returns an empty lease instead of blocking
+    Lease tryCheckout();
+
+    size_t maxConnections() const;
+    // Per-connection counters in creation order. A connection that is checked
+    // out shows its counters as of its last return; its holder reads the live
+    // ones with getStats().
+    std::vector<ConnectionStats> stats() const;
+
+private:
+    struct Slot {
+        std::unique_ptr<Connection> connection;
+        ConnectionStats returned_stats;
+        bool leased;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable returned;
+    std::vector<Slot> slots;
+    size_t max_connections;
+    std::string host;
+    int port;
+    bool quiet;
+
+    // Caller holds mutex; empty lease if nothing is free
+    Lease take();
+    void checkin(size_t slot);
+};
@@ -2,7 +2,9 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <cstdint>
+#include <cstddef>
 
 class AESWrapper {
 private:
@@ -10,15 +12,51 @@ private:
     // Using zero IV since we're in CBC mode - not ideal for production but matches protocol spec
     static constexpr uint8_t IV[16] = {0};
     
+    // CBC encryption and decryption keyed once in the constructor, so each
+    // call only resets the IV; Crypto++ runs them on AES-NI when the CPU has it
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
 public:
     static constexpr size_t KEY_SIZE = 16;  // 128 bits
     static constexpr size_t IV_SIZE = 16;   // 128 bits
+    static constexpr size_t BLOCK_SIZE = 16;
     
     AESWrapper();
     explicit AESWrapper(const std::vector<uint8_t>& key);
+    AESWrapper(AESWrapper&& other);
+    AESWrapper& operator=(AESWrapper&& other);
+    ~AESWrapper();
     
     static std::vector<uint8_t> generateKey();
     
+    // PKCS#7 always adds 1-16 bytes of padding
+    static size_t ciphertextSize(size_t plaintext_size) {
+        return (plaintext_size / BLOCK_SIZE + 1) * BLOCK_SIZE;
+    }
+    
+    // Buffer forms: out needs ciphertextSize(length) bytes for encrypt and
+    // length bytes for decrypt, and may be the same buffer as in. They return
+    // the number of bytes written.
+    size_t encrypt(const uint8_t* in, size_t length, uint8_t* out);
+    size_t decrypt(const uint8_t* in, size_t length, uint8_t* out);
+    // Replace data with its ciphertext / plaintext without another buffer
+    void encryptInPlace(std::vector<uint8_t>& data);
+    void decryptInPlace(std::vector<uint8_t>& data);
+    
+    // File chunk framing: a random IV followed by the data encrypted under
+    // it, so chunks can be processed independently and in any order
+    static size_t framedSize(size_t plaintext_size) {
+        return IV_SIZE + ciphertextSize(plaintext_size);
+    }
+    // The length plaintext bytes at chunk + IV_SIZE are encrypted in place
+    // and a fresh IV is written in front; chunk needs framedSize(length)
+    // bytes. Returns the framed size.
+    size_t encryptFramed(uint8_t* chunk, size_t length);
+    // Decrypts a framed chunk in place, leaving the plaintext at
+    // chunk + IV_SIZE; returns its size
+    size_t decryptFramed(uint8_t* chunk, size_t length);
+    
     std::vector<uint8_t> encrypt(const std::vector<uint8_t>& plaintext);
     std::vector<uint8_t> encrypt(const std::string& plaintext);
     
@@ -26,5 +64,20 @@ public:
     std::string decryptToString(const std::vector<uint8_t>& ciphertext);
     
     const std::vector<uint8_t>& getKey() const { return key; }
+    
+    // Incremental CBC decryption for ciphertext that arrives in pieces; the
+    // final block is held back until finish() so padding can be stripped
+    class Decryptor {
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> impl;
+    
+    public:
+        explicit Decryptor(const AESWrapper& aes);
+        ~Decryptor();
+    
+        // Replaces out with whatever plaintext the new bytes completed
+        void update(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+        void finish(std::vector<uint8_t>& out);
+    };
 };
-
@@ -2,10 +2,16 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <cstdint>
 
 class RSAPrivateWrapper {
 private:
+    // Loaded key, OAEP decryptor and RNG live as long as the wrapper so each
+    // decrypt skips DER decoding and RNG seeding
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+    
     std::vector<uint8_t> private_key;
     std::vector<uint8_t> public_key;
     
@@ -19,6 +25,10 @@ public:
     // Reconstructs from existing private key (also derives public key)
     explicit RSAPrivateWrapper(const std::vector<uint8_t>& private_key);
     
+    RSAPrivateWrapper(RSAPrivateWrapper&& other);
+    RSAPrivateWrapper& operator=(RSAPrivateWrapper&& other);
+    ~RSAPrivateWrapper();
+    
     std::vector<uint8_t> decrypt(const std::vector<uint8_t>& ciphertext);
     std::string decryptToString(const std::vector<uint8_t>& ciphertext);
     
@@ -29,4 +39,3 @@ public:
     void savePrivateKey(const std::string& filename);
     static RSAPrivateWrapper loadPrivateKey(const std::string& filename);
 };
-
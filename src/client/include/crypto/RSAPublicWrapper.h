@@ -2,10 +2,15 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <cstdint>
 
 class RSAPublicWrapper {
 private:
+    // Parsed key, OAEP encryptor and RNG, built once in the constructor
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+    
     std::vector<uint8_t> public_key;
     
 public:
@@ -13,9 +18,12 @@ public:
     
     explicit RSAPublicWrapper(const std::vector<uint8_t>& public_key);
     
+    RSAPublicWrapper(RSAPublicWrapper&& other);
+    RSAPublicWrapper& operator=(RSAPublicWrapper&& other);
+    ~RSAPublicWrapper();
+    
     std::vector<uint8_t> encrypt(const std::vector<uint8_t>& plaintext);
     std::vector<uint8_t> encrypt(const std::string& plaintext);
     
     const std::vector<uint8_t>& getKey() const { return public_key; }
 };
-
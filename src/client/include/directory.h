@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "message.h"
+
+// In-memory copy of the server's client list. Entries are never removed on the
+// server, so the cache only grows: refreshes fetch clients registered after
+// the cursor (server-side row id) instead of the whole list.
+class ClientDirectory {
+private:
+    std::vector<ClientInfo> clients;  // in registration order
+    std::unordered_map<std::string, size_t> by_name;
+    // Keyed by the raw 16 ID bytes, not the hex form
+    std::unordered_map<std::string, size_t> by_id;
+    uint32_t cursor;
+    
+public:
+    ClientDirectory();
+    
+    const ClientInfo* findByName(const std::string& name) const;
+    const ClientInfo* findById(const uint8_t* client_id) const;
+    
+    // Records a single client (e.g. from a name lookup) without moving the cursor
+    void add(const ClientInfo& client);
+    // Adds newly registered clients and advances the cursor
+    void merge(const std::vector<ClientInfo>& new_clients, uint32_t new_cursor);
+    
+    uint32_t getCursor() const { return cursor; }
+    const std::vector<ClientInfo>& getClients() const { return clients; }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Single-threaded epoll reactor running on its own thread. File descriptors,
+// timers and their callbacks belong to the loop thread; other threads hand it
+// work with post().
+class EventLoop {
+public:
+    typedef std::function<void(uint32_t events)> IoCallback;
+    typedef std::function<void()> Task;
+
+    EventLoop();
+    // Stops the loop thread if it is still running
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void start();
+    // Runs tasks already posted, then joins the loop thread. From a loop
+    // callback it only tells the loop to finish; the thread is joined later.
+    void stop();
+
+    // Thread-safe: queues task to run on the loop thread
+    void post(Task task);
+    bool inLoopThread() const;
+
+    // Loop thread only. events are EPOLLIN/EPOLLOUT/...; errors and hang-ups
+    // are always reported.
+    void watch(int fd, uint32_t events, IoCallback callback);
+    void modify(int fd, uint32_t events);
+    void unwatch(int fd);
+
+    // Loop thread only. Calls task every interval_ms until cancelled; returns
+    // an ID for cancelTimer()
+    int addTimer(unsigned interval_ms, Task task);
+    void cancelTimer(int timer_id);
+
+private:
+    int epoll_fd;
+    // eventfd that wakes epoll_wait when a task is posted
+    int wake_fd;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::mutex tasks_mutex;
+    std::vector<Task> tasks;
+
+    std::unordered_map<int, IoCallback> callbacks;
+
+    void run();
+    void runPostedTasks();
+};
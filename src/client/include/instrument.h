@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+// Per-phase timing and byte counters for the request hot path. Only compiled
+// in with -DMESSAGEU_INSTRUMENT (make INSTRUMENT=1); otherwise the macros
+// below expand to nothing and no clock is ever read.
+//
+//   INSTRUMENT_TIMER(timer, instrument::PHASE_SEND);   // times until end of scope
+//   INSTRUMENT_ADD_BYTES(timer, length);               // bytes moved in that scope
+//
+// Counters are relaxed atomics, so the background thread may record too.
+namespace instrument {
+
+enum Phase {
+    PHASE_CONNECT,
+    PHASE_LIST_RESOLVE,
+    PHASE_ENCRYPT,
+    PHASE_SEND,
+    PHASE_SERVER_WAIT,
+    PHASE_RECEIVE,
+    PHASE_DECRYPT,
+    PHASE_DISK_WRITE,
+    PHASE_COUNT
+};
+
+#ifdef MESSAGEU_INSTRUMENT
+constexpr bool COMPILED_IN = true;
+#else
+constexpr bool COMPILED_IN = false;
+#endif
+
+const char* phaseName(Phase phase);
+
+void record(Phase phase, uint64_t elapsed_ns, uint64_t bytes);
+void reset();
+// JSON object keyed by phase name: count, bytes, total/max ns and a log2
+// histogram as [upper bound ns, count] pairs; {"enabled": false} when not compiled in
+void dump(std::ostream& out);
+
+#ifdef MESSAGEU_INSTRUMENT
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Phase phase);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    void addBytes(uint64_t count) { bytes += count; }
+
+private:
+    Phase phase;
+    uint64_t start_ns;
+    uint64_t bytes;
+};
+#endif
+
+} // namespace instrument
+
+#ifdef MESSAGEU_INSTRUMENT
+#define INSTRUMENT_TIMER(name, phase) instrument::ScopedTimer name(phase)
+#define INSTRUMENT_ADD_BYTES(name, count) name.addBytes(count)
+#else
+#define INSTRUMENT_TIMER(name, phase) ((void)0)
+#define INSTRUMENT_ADD_BYTES(name, count) ((void)0)
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+class RSAPublicWrapper;
+
+constexpr const char* PEER_KEYS_FILE = "peers.info";
+
+// Peer public keys, persisted next to my.info so key exchange with a known peer
+// needs no REQ_PUBLIC_KEY round trip. Each line of the file is
+// "<client id hex> <public key base64>"; a later line for the same ID wins.
+class PublicKeyCache {
+private:
+    struct Entry {
+        std::vector<uint8_t> key;
+        // Parsed lazily on first encrypt and kept for the life of the cache
+        std::shared_ptr<RSAPublicWrapper> wrapper;
+    };
+    
+    std::string path;
+    // Keyed by the raw 16 ID bytes
+    std::unordered_map<std::string, Entry> entries;
+    
+    static std::string idKey(const uint8_t* client_id);
+    
+public:
+    explicit PublicKeyCache(const std::string& path = PEER_KEYS_FILE);
+    
+    // Returns the number of keys loaded; a missing file is not an error
+    size_t load();
+    
+    const std::vector<uint8_t>* find(const uint8_t* client_id) const;
+    // Stores the key and appends it to the file if it is new or changed
+    void put(const uint8_t* client_id, const std::vector<uint8_t>& public_key);
+    // Returns nullptr if the key is unknown
+    std::shared_ptr<RSAPublicWrapper> getWrapper(const uint8_t* client_id);
+    
+    size_t size() const { return entries.size(); }
+};
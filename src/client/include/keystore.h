@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+class AESWrapper;
+class RSAPrivateWrapper;
+class RSAPublicWrapper;
+
+constexpr const char* SYMMETRIC_KEYS_FILE = "keys.bin";
+
+// Append-only file of peer AES keys, each sealed with our own RSA public key
+// so only the holder of my.info's private key can read them back. Layout:
+//
+//   "MUK1" | sealed size (4, LE) | records of client id (16) + sealed key
+//
+// A later record for the same ID wins. The file is mapped read-only when
+// opened, so nothing is read or decrypted until a record is asked for.
+class SealedKeyFile {
+public:
+    // fresh discards whatever the file holds (keys of an earlier registration)
+    SealedKeyFile(const std::string& path, RSAPrivateWrapper& owner, bool fresh);
+    ~SealedKeyFile();
+
+    SealedKeyFile(const SealedKeyFile&) = delete;
+    SealedKeyFile& operator=(const SealedKeyFile&) = delete;
+
+    // Records that were in the file when it was opened
+    size_t recordCount() const { return record_count; }
+    const uint8_t* recordId(size_t index) const;
+    // Throws if the record was sealed for another key pair
+    std::vector<uint8_t> unseal(size_t index) const;
+    void append(const uint8_t* client_id, const std::vector<uint8_t>& key);
+
+private:
+    std::string path;
+    RSAPrivateWrapper& owner;
+    std::unique_ptr<RSAPublicWrapper> sealer;
+    int fd;
+    const uint8_t* map;
+    size_t map_size;
+    size_t sealed_size;
+    size_t record_count;
+
+    size_t recordSize() const { return CLIENT_ID_SIZE + sealed_size; }
+    bool readHeader(size_t file_size);
+    void writeHeader();
+};
+
+// Peer AES keys, keyed by the raw 16-byte client ID in a flat open-addressing
+// table with linear probing. IDs and keys are stored inline, so a lookup is a
+// hash of the ID bytes and a few memcmp's - no hex formatting, no allocation.
+// Keys are only ever added or replaced, never removed, so there are no
+// tombstones to deal with.
+//
+// With a key file attached, saved keys are indexed on the first lookup and
+// each is unsealed (one RSA decrypt) only when that peer is first used.
+class SymmetricKeyStore {
+public:
+    static constexpr size_t KEY_SIZE = 16;
+
+    SymmetricKeyStore();
+    ~SymmetricKeyStore();
+
+    SymmetricKeyStore(const SymmetricKeyStore&) = delete;
+    SymmetricKeyStore& operator=(const SymmetricKeyStore&) = delete;
+
+    // Persists keys to path from now on, sealed for owner, and makes the keys
+    // saved there by earlier runs available. fresh (a new registration) drops
+    // both the file's and the in-memory keys.
+    void attach(const std::string& path, RSAPrivateWrapper& owner, bool fresh);
+
+    // Returns the KEY_SIZE key bytes, or nullptr; valid until the next put()
+    const uint8_t* find(const uint8_t* client_id);
+    // True for saved keys not yet unsealed too, so this never costs an RSA decrypt
+    bool contains(const uint8_t* client_id);
+    // Adds or replaces the key; throws if it is not KEY_SIZE bytes
+    void put(const uint8_t* client_id, const std::vector<uint8_t>& key);
+    // AES keyed for this peer, built on first use and kept until the key
+    // changes; nullptr if there is no key. The object itself stays put when
+    // the table grows.
+    AESWrapper* cipher(const uint8_t* client_id);
+
+    size_t size() const { return count; }
+
+private:
+    enum SlotState : uint8_t {
+        SLOT_EMPTY,
+        SLOT_SEALED,   // known from the key file, not decrypted yet
+        SLOT_READY,
+        SLOT_BROKEN    // the saved key could not be unsealed
+    };
+
+    struct Slot {
+        uint8_t id[CLIENT_ID_SIZE];
+        uint8_t key[KEY_SIZE];
+        SlotState state;
+        uint32_t record;
+        std::unique_ptr<AESWrapper> aes;
+    };
+
+    // Power of two, so probing can mask instead of divide
+    std::vector<Slot> slots;
+    size_t count;
+    std::unique_ptr<SealedKeyFile> file;
+    bool indexed;
+
+    // Index of the slot holding client_id, or of the empty slot where it would go
+    size_t probe(const uint8_t* client_id) const;
+    // Slot index for client_id, claiming an empty slot if needed
+    size_t claim(const uint8_t* client_id);
+    void grow();
+    void indexFile();
+    // Looks up client_id, unsealing a saved key on first use; nullptr if none
+    Slot* ready(const uint8_t* client_id);
+};
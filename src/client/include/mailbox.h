@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "message.h"
+
+class Connection;
+
+// Incremental decoder for the message records of a RES_WAITING_MESSAGES or
+// RES_MESSAGE_PAGE payload read straight from the socket. Only one message's fixed fields are buffered at a time; content
+// is either read into memory or streamed to a sink in READ_BLOCK_SIZE pieces.
+class MailboxReader {
+private:
+    Connection& connection;
+    uint64_t payload_remaining;
+    uint32_t content_remaining;
+    uint32_t content_size;
+    uint32_t last_id;
+    
+    void read(uint8_t* data, size_t length);
+    
+public:
+    static constexpr size_t READ_BLOCK_SIZE = 64 * 1024;
+    
+    MailboxReader(Connection& connection, uint32_t payload_size);
+    // Closes the connection if the payload wasn't consumed, since the stream
+    // position is then unknown
+    ~MailboxReader();
+    
+    MailboxReader(const MailboxReader&) = delete;
+    MailboxReader& operator=(const MailboxReader&) = delete;
+    
+    // Reads the next message's fixed fields, skipping any unread content of
+    // the previous one; msg.content is left empty. Returns false at the end.
+    // Throws, closing the connection, if the content size runs past the
+    // payload, so contentSize() can be trusted for allocations.
+    bool next(Message& msg);
+    
+    uint32_t contentSize() const { return content_size; }
+    // ID of the last message next() returned, 0 before the first
+    uint32_t lastId() const { return last_id; }
+    void readContent(std::vector<uint8_t>& out);
+    void streamContent(const std::function<void(const uint8_t*, size_t)>& sink);
+    void skipContent();
+    
+    bool finished() const { return payload_remaining == 0; }
+};
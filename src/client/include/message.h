@@ -3,12 +3,26 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
 struct ClientInfo {
     uint8_t id[16];
     std::string name;
 };
 
+// One entry of a name lookup response; found is false for unknown names
+struct ClientLookup {
+    uint8_t id[16];
+    bool found;
+    std::vector<uint8_t> public_key;
+};
+
+// Content of a chunked file message (see MessageUtils::isChunkedFile)
+struct FileDescriptor {
+    uint32_t chunk_count;
+    uint64_t total_size;  // encrypted bytes across all chunks
+};
+
 struct Message {
     uint32_t id;
     uint8_t from_client[16];
@@ -16,12 +30,113 @@ struct Message {
     std::vector<uint8_t> content;
 };
 
+// Non-owning views into a response payload. They point into the buffer they
+// were decoded from and must not outlive it; nothing is copied or allocated.
+struct MessageView {
+    uint32_t id;
+    const uint8_t* from_client;
+    uint8_t type;
+    const uint8_t* content;
+    uint32_t content_size;
+};
+
+struct ClientInfoView {
+    const uint8_t* id;
+    const char* name;
+    size_t name_length;
+    
+    std::string nameString() const { return std::string(name, name_length); }
+};
+
+// Decode one entry at data; on success sets consumed to the entry's size.
+// Returns false if the remaining bytes don't hold a complete entry.
+bool decodeView(const uint8_t* data, size_t remaining, MessageView& view, size_t& consumed);
+bool decodeView(const uint8_t* data, size_t remaining, ClientInfoView& view, size_t& consumed);
+
+// Forward range over the entries of a payload, decoding each on demand
+template <typename View>
+class PayloadView {
+private:
+    const uint8_t* data;
+    size_t size;
+    
+public:
+    class iterator {
+    private:
+        const uint8_t* pos;
+        const uint8_t* end;
+        View current;
+        size_t consumed;
+        
+        void load() {
+            // A truncated trailing entry ends the range
+            if (!decodeView(pos, end - pos, current, consumed)) {
+                pos = end;
+            }
+        }
+        
+    public:
+        iterator(const uint8_t* pos, const uint8_t* end) : pos(pos), end(end), current(), consumed(0) {
+            if (pos != end) {
+                load();
+            }
+        }
+        
+        const View& operator*() const { return current; }
+        const View* operator->() const { return &current; }
+        
+        iterator& operator++() {
+            pos += consumed;
+            if (pos != end) {
+                load();
+            }
+            return *this;
+        }
+        
+        bool operator==(const iterator& other) const { return pos == other.pos; }
+        bool operator!=(const iterator& other) const { return pos != other.pos; }
+    };
+    
+    PayloadView(const uint8_t* data, size_t size) : data(data), size(size) {}
+    
+    iterator begin() const { return iterator(data, data + size); }
+    iterator end() const { return iterator(data + size, data + size); }
+};
+
+typedef PayloadView<MessageView> MessageListView;
+typedef PayloadView<ClientInfoView> ClientListView;
+
 class MessageUtils {
 public:
     static std::vector<ClientInfo> parseClientList(const std::vector<uint8_t>& payload);
+    // Incremental list: 4-byte cursor followed by the same entries as parseClientList
+    static std::vector<ClientInfo> parseClientListSince(const std::vector<uint8_t>& payload, uint32_t* cursor);
     // Also populates client_id output parameter with the key owner's ID
     static std::vector<uint8_t> parsePublicKey(const std::vector<uint8_t>& payload, uint8_t* client_id);
+    // Entries come back in request order: 16-byte ID (all zero if unknown) + public key
+    static std::vector<ClientLookup> parseLookupResponse(const std::vector<uint8_t>& payload);
     static std::vector<Message> parseMessages(const std::vector<uint8_t>& payload);
+    // RES_MESSAGE_PAGE: a "more pages" byte followed by the same records as parseMessages
+    static std::vector<Message> parseMessagePage(const std::vector<uint8_t>& payload, bool* more);
+    
+    // Zero-copy alternatives to parseMessages/parseClientList. Temporaries are
+    // rejected because the views would dangle as soon as the statement ends.
+    static MessageListView viewMessages(const std::vector<uint8_t>& payload);
+    static MessageListView viewMessages(std::vector<uint8_t>&& payload) = delete;
+    static ClientListView viewClientList(const std::vector<uint8_t>& payload);
+    static ClientListView viewClientList(std::vector<uint8_t>&& payload) = delete;
+    
+    // Message IDs in record order; 0 marks a record the server rejected
+    static std::vector<uint32_t> parseBatchResponse(const std::vector<uint8_t>& payload);
+    static FileDescriptor parseFileDescriptor(const std::vector<uint8_t>& content);
+    // True for every form of a chunked file
+    static bool isChunkedFile(uint8_t msg_type);
+    // Returns the chunk carried by a RES_FILE_CHUNK payload in AESWrapper's
+    // framed form; throws unless it is chunk expected_index of message
+    // expected_message_id. A chunk of a msg_type MSG_TYPE_FILE_CHUNKED
+    // transfer was encrypted under the zero IV, which is put in front of it.
+    static std::vector<uint8_t> parseFileChunk(const std::vector<uint8_t>& payload, uint32_t expected_message_id,
+                                               uint32_t expected_index, uint8_t msg_type);
     static std::string bytesToHex(const uint8_t* bytes, size_t length);
     static void hexToBytes(const std::string& hex, uint8_t* bytes, size_t length);
     static std::string clientIdToString(const uint8_t* client_id);
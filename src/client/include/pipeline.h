@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+class Connection;
+
+// Keeps up to `window` requests in flight on one connection. The server handles
+// a socket's requests one after another and answers in the same order, so
+// responses are matched to requests first-in first-out.
+//
+// The window bounds both latency and buffering: once it is full, submit() reads
+// the oldest response before sending. Requests and responses that are both large
+// should use a small window so neither side blocks on a full socket buffer.
+class RequestPipeline {
+public:
+    // Called with each response in request order. An error response is passed
+    // through with code RES_GENERAL_ERROR rather than thrown, since the stream
+    // is still in step and later responses are unaffected.
+    typedef std::function<void(const ResponseHeader&, std::vector<uint8_t>&)> Handler;
+
+    static constexpr size_t DEFAULT_WINDOW = 16;
+
+    // The connection must already be open
+    explicit RequestPipeline(Connection& connection, size_t window = DEFAULT_WINDOW);
+    // Closes the connection if responses are still outstanding, since nothing
+    // would read them
+    ~RequestPipeline();
+
+    RequestPipeline(const RequestPipeline&) = delete;
+    RequestPipeline& operator=(const RequestPipeline&) = delete;
+
+    // Sends prefix + content as one request; handler may be empty. Throws and
+    // closes the connection if the socket fails.
+    void submit(const uint8_t* prefix, size_t prefix_size, const std::vector<uint8_t>& content,
+                Handler handler);
+    void submit(const std::vector<uint8_t>& request, Handler handler);
+
+    // Reads responses until none are outstanding
+    void drain();
+
+    size_t inFlight() const { return pending.size(); }
+    size_t errors() const { return error_count; }
+
+private:
+    Connection& connection;
+    size_t window;
+    std::deque<Handler> pending;
+    std::vector<uint8_t> payload;
+    size_t error_count;
+
+    void receiveOne();
+    void fail(const char* what);
+};
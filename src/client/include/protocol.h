@@ -9,6 +9,24 @@ constexpr size_t CLIENT_ID_SIZE = 16;
 constexpr size_t USERNAME_MAX_SIZE = 255;
 constexpr size_t PUBLIC_KEY_SIZE = 160;
 constexpr size_t HEADER_SIZE = 23;
+// Header plus the fixed fields that precede content in a send request
+constexpr size_t SEND_MESSAGE_PREFIX_SIZE = HEADER_SIZE + CLIENT_ID_SIZE + 1 + 4;
+constexpr size_t FILE_CHUNK_PREFIX_SIZE = HEADER_SIZE + CLIENT_ID_SIZE + 4 + 4 + 1 + 4;
+// Upper bounds for one REQ_SEND_BATCH request; larger outboxes are split
+constexpr size_t MAX_BATCH_MESSAGES = 1000;
+constexpr size_t MAX_BATCH_BYTES = 16 * 1024 * 1024;
+// Plaintext bytes per chunk in a chunked file transfer
+constexpr size_t FILE_CHUNK_SIZE = 64 * 1024;
+// File chunks (sent or fetched) kept in flight at once on a pipelined connection
+constexpr size_t FILE_CHUNK_WINDOW = 4;
+// Batch requests in flight at once when an outbox spans several batches
+constexpr size_t BATCH_WINDOW = 2;
+// Asked for per REQ_MESSAGE_PAGE; the server may cap either lower. A page
+// can exceed the byte limit by one message, since each page holds at least one.
+constexpr uint32_t MESSAGE_PAGE_MESSAGES = 500;
+constexpr uint32_t MESSAGE_PAGE_BYTES = 8 * 1024 * 1024;
+// How long a REQ_WAIT_MESSAGES request asks the server to hold it open
+constexpr uint32_t MESSAGE_WAIT_MS = 30 * 1000;
 
 // Request codes
 constexpr uint16_t REQ_REGISTER = 600;
@@ -16,6 +34,20 @@ constexpr uint16_t REQ_CLIENT_LIST = 601;
 constexpr uint16_t REQ_PUBLIC_KEY = 602;
 constexpr uint16_t REQ_SEND_MESSAGE = 603;
 constexpr uint16_t REQ_WAITING_MESSAGES = 604;
+constexpr uint16_t REQ_CLIENT_LIST_SINCE = 605;
+constexpr uint16_t REQ_LOOKUP_CLIENTS = 606;
+constexpr uint16_t REQ_SEND_FILE_CHUNK = 607;
+constexpr uint16_t REQ_FETCH_FILE_CHUNK = 608;
+constexpr uint16_t REQ_SEND_BATCH = 609;
+constexpr uint16_t REQ_MESSAGE_PAGE = 610;
+constexpr uint16_t REQ_ACK_MESSAGES = 611;
+constexpr uint16_t REQ_WAIT_MESSAGES = 612;
+// REQ_SEND_FILE_CHUNK for chunks that carry their own IV; the transfer is
+// published as MSG_TYPE_FILE_CHUNKED_IV
+constexpr uint16_t REQ_SEND_FILE_CHUNK_IV = 613;
+// REQ_SEND_FILE_CHUNK_IV for chunks framed by compression.h before they were
+// encrypted; the transfer is published as MSG_TYPE_FILE_CHUNKED_COMPRESSED
+constexpr uint16_t REQ_SEND_FILE_CHUNK_COMPRESSED = 614;
 constexpr uint16_t REQ_EXIT = 0;
 
 // Menu codes
@@ -27,6 +59,7 @@ constexpr uint16_t MENU_SEND_TEXT = 150;
 constexpr uint16_t MENU_SEND_SYM_KEY_REQUEST = 151;
 constexpr uint16_t MENU_SEND_SYM_KEY = 152;
 constexpr uint16_t MENU_SEND_FILE = 153;
+constexpr uint16_t MENU_SEND_TEXT_BATCH = 154;
 
 // Response codes
 constexpr uint16_t RES_REGISTRATION_SUCCESS = 2100;
@@ -34,6 +67,13 @@ constexpr uint16_t RES_CLIENT_LIST = 2101;
 constexpr uint16_t RES_PUBLIC_KEY = 2102;
 constexpr uint16_t RES_MESSAGE_SENT = 2103;
 constexpr uint16_t RES_WAITING_MESSAGES = 2104;
+constexpr uint16_t RES_CLIENT_LIST_SINCE = 2105;
+constexpr uint16_t RES_LOOKUP_CLIENTS = 2106;
+constexpr uint16_t RES_FILE_CHUNK_STORED = 2107;
+constexpr uint16_t RES_FILE_CHUNK = 2108;
+constexpr uint16_t RES_BATCH_SENT = 2109;
+constexpr uint16_t RES_MESSAGE_PAGE = 2110;
+constexpr uint16_t RES_MESSAGES_ACKED = 2111;
 constexpr uint16_t RES_GENERAL_ERROR = 9000;
 
 // Message types
@@ -41,6 +81,25 @@ constexpr uint8_t MSG_TYPE_SYM_KEY_REQUEST = 1;
 constexpr uint8_t MSG_TYPE_SYM_KEY_SEND = 2;
 constexpr uint8_t MSG_TYPE_TEXT_MESSAGE = 3;
 constexpr uint8_t MSG_TYPE_FILE = 4;
+// Content is a descriptor (chunk count + total size); chunks are fetched
+// separately. Each chunk is encrypted under the zero IV.
+constexpr uint8_t MSG_TYPE_FILE_CHUNKED = 5;
+// Text and file content framed by compression.h before it was encrypted
+constexpr uint8_t MSG_TYPE_TEXT_COMPRESSED = 6;
+constexpr uint8_t MSG_TYPE_FILE_COMPRESSED = 7;
+// Like MSG_TYPE_FILE_CHUNKED, but each chunk is a random IV followed by the
+// data encrypted under it (AESWrapper's framed form)
+constexpr uint8_t MSG_TYPE_FILE_CHUNKED_IV = 8;
+// Like MSG_TYPE_FILE_CHUNKED_IV, but each chunk was framed by
+// compression::frameChunk before it was encrypted
+constexpr uint8_t MSG_TYPE_FILE_CHUNKED_COMPRESSED = 9;
+
+// One queued record of a REQ_SEND_BATCH request (content already encrypted)
+struct OutgoingMessage {
+    uint8_t to_client[CLIENT_ID_SIZE];
+    uint8_t type;
+    std::vector<uint8_t> content;
+};
 
 struct RequestHeader {
     uint8_t client_id[CLIENT_ID_SIZE];
@@ -64,6 +123,14 @@ public:
         uint32_t payload_size
     );
     
+    // Same layout as packRequestHeader, written into a caller-provided HEADER_SIZE buffer
+    static void writeRequestHeader(
+        uint8_t* out,
+        const uint8_t* client_id,
+        uint16_t code,
+        uint32_t payload_size
+    );
+    
     static ResponseHeader unpackResponseHeader(const std::vector<uint8_t>& data);
     
     // Registration uses null client_id (not yet assigned by server)
@@ -74,6 +141,18 @@ public:
     
     static std::vector<uint8_t> packClientListRequest(const uint8_t* client_id);
     
+    // Asks only for clients registered after the given directory cursor
+    static std::vector<uint8_t> packClientListSinceRequest(
+        const uint8_t* client_id,
+        uint32_t cursor
+    );
+    
+    // Resolves a batch of names to ID + public key; one 255-byte name field per entry
+    static std::vector<uint8_t> packLookupRequest(
+        const uint8_t* client_id,
+        const std::vector<std::string>& names
+    );
+    
     static std::vector<uint8_t> packPublicKeyRequest(
         const uint8_t* client_id,
         const uint8_t* target_client_id
@@ -81,11 +160,88 @@ public:
     
     static std::vector<uint8_t> packWaitingMessagesRequest(const uint8_t* client_id);
     
+    // Up to max_messages / max_bytes of the messages with IDs above after_id;
+    // the response is a "more pages" byte followed by message records
+    static std::vector<uint8_t> packMessagePageRequest(
+        const uint8_t* client_id,
+        uint32_t after_id,
+        uint32_t max_messages,
+        uint32_t max_bytes
+    );
+    
+    // REQ_MESSAGE_PAGE that the server holds for up to timeout_ms while the
+    // page would be empty; answered with RES_MESSAGE_PAGE
+    static std::vector<uint8_t> packWaitMessagesRequest(
+        const uint8_t* client_id,
+        uint32_t after_id,
+        uint32_t timeout_ms,
+        uint32_t max_messages,
+        uint32_t max_bytes
+    );
+    
+    // Deletes our messages with IDs up to through_id from the server
+    static std::vector<uint8_t> packAckMessagesRequest(
+        const uint8_t* client_id,
+        uint32_t through_id
+    );
+    
     static std::vector<uint8_t> packSendMessageRequest(
         const uint8_t* from_client_id,
         const uint8_t* to_client_id,
         uint8_t msg_type,
         const std::vector<uint8_t>& content
     );
+    
+    // Packs messages [begin, end) as one batch: 4-byte count, then per record
+    // to_client + type + 4-byte content size + content
+    static std::vector<uint8_t> packBatchSendRequest(
+        const uint8_t* from_client_id,
+        const std::vector<OutgoingMessage>& messages,
+        size_t begin,
+        size_t end
+    );
+    
+    // Scatter-gather form of packSendMessageRequest: writes everything except
+    // the content into a SEND_MESSAGE_PREFIX_SIZE buffer so the content can be
+    // sent from the caller's buffer without being copied behind the header
+    static void packSendMessagePrefix(
+        uint8_t* out,
+        const uint8_t* from_client_id,
+        const uint8_t* to_client_id,
+        uint8_t msg_type,
+        uint32_t content_size
+    );
+    
+    // One framed chunk of a file (REQ_SEND_FILE_CHUNK_IV, or
+    // REQ_SEND_FILE_CHUNK_COMPRESSED if compressed); the server turns the
+    // transfer into a MSG_TYPE_FILE_CHUNKED_IV or MSG_TYPE_FILE_CHUNKED_COMPRESSED
+    // message once the last chunk lands
+    static std::vector<uint8_t> packFileChunkRequest(
+        const uint8_t* from_client_id,
+        const uint8_t* to_client_id,
+        uint32_t transfer_id,
+        uint32_t chunk_index,
+        bool is_last,
+        bool compressed,
+        const std::vector<uint8_t>& content
+    );
+    
+    // Scatter-gather form of packFileChunkRequest (FILE_CHUNK_PREFIX_SIZE bytes)
+    static void packFileChunkPrefix(
+        uint8_t* out,
+        const uint8_t* from_client_id,
+        const uint8_t* to_client_id,
+        uint32_t transfer_id,
+        uint32_t chunk_index,
+        bool is_last,
+        bool compressed,
+        uint32_t content_size
+    );
+    
+    static std::vector<uint8_t> packFetchFileChunkRequest(
+        const uint8_t* client_id,
+        uint32_t message_id,
+        uint32_t chunk_index
+    );
 };
 
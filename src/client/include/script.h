@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iosfwd>
+#include <cstddef>
+#include <cstdint>
+
+class MessageUClient;
+class MailboxReader;
+struct Message;
+
+// Runs client operations read one per line from a script, all over one
+// session. Blank lines and lines starting with '#' are ignored.
+//
+//   register <name>
+//   list
+//   pubkey <name>
+//   keyreq <name>            (queued)
+//   keysend <name>           (queued, but sent at once with whatever is queued,
+//                            so the key is only kept once the server accepts it)
+//   send <name> <text...>    (queued; text runs to the end of the line)
+//   sendfile <name> <path>   (queued; larger than one file chunk, it uploads
+//                            in the background on a pooled connection)
+//   fetch
+//   flush
+//   stats                    (totals, then opened/reused/failed per connection)
+//   timings                  (instrumentation counters as one line of JSON)
+//
+// Every result is one tab-separated line starting with the script line number:
+//
+//   <line> OK <command> [<fields>...]
+//   <line> ERR <command> <reason>
+//   <line> MSG <message id> <sender> <type> <detail>     (fetch only)
+//
+// Queued commands go out together in REQ_SEND_BATCH requests; their results are
+// written when the outbox is flushed, which happens before any other command,
+// when the batch limit is reached, on "flush" and at the end of the script.
+// Background uploads report as soon as they finish; "flush", "register" and
+// the end of the script wait for them.
+class ScriptRunner {
+private:
+    struct Pending {
+        size_t line;
+        std::string command;
+        // keysend only: the new key and its peer, kept once the server accepts it
+        std::vector<uint8_t> key;
+        std::vector<uint8_t> target_id;
+    };
+    // A chunked sendfile running on its own thread and pooled connection
+    struct Upload;
+    // A chunked file fetched by downloadChunkedFiles()
+    struct Download;
+
+    MessageUClient& client;
+    std::ostream& out;
+    std::vector<Pending> pending;
+    std::vector<std::unique_ptr<Upload>> uploads;
+    size_t failures;
+
+    void execute(size_t line, const std::string& command, const std::string& args);
+    void flush();
+    // Reports the uploads that have finished; with wait, all of them
+    void collectUploads(bool wait);
+    void runUpload(Upload& upload);
+
+    void registerClient(size_t line, const std::string& name);
+    void listClients(size_t line);
+    void publicKey(size_t line, const std::string& name);
+    void requestKey(size_t line, const std::string& name);
+    void sendKey(size_t line, const std::string& name);
+    void sendText(size_t line, const std::string& name, const std::string& text);
+    void sendFile(size_t line, const std::string& name, const std::string& path);
+    void fetch(size_t line);
+    // Fetches the files side by side, on the session and any idle pooled
+    // connections
+    void downloadChunkedFiles(std::vector<Download>& downloads);
+    // download carries the result for a chunked file message
+    void reportMessage(size_t line, const Message& msg, MailboxReader* mailbox,
+                       const Download* download = nullptr);
+
+    // Resolves name and checks a symmetric key exists; reports ERR otherwise
+    bool resolveWithKey(size_t line, const std::string& command, const std::string& name,
+                        uint8_t* target_id);
+    void queue(size_t line, const std::string& command, const uint8_t* target_id,
+               uint8_t msg_type, const std::vector<uint8_t>& content);
+
+    void ok(size_t line, const std::string& command, const std::string& fields = std::string());
+    void error(size_t line, const std::string& command, const std::string& reason);
+
+public:
+    ScriptRunner(MessageUClient& client, std::ostream& out);
+    // Waits for background uploads without reporting them
+    ~ScriptRunner();
+
+    // Returns the number of commands that failed
+    size_t run(std::istream& in);
+
+    // Escapes backslash, tab, CR and LF so a field stays on one line
+    static std::string escape(const std::string& text);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+// Fixed set of threads running submitted tasks in FIFO order. Tasks start in
+// the order they were submitted, so a task may wait on the result of one
+// submitted before it without risking a deadlock.
+class WorkerPool {
+public:
+    typedef std::function<void()> Task;
+
+    // threads == 0 means one per core
+    explicit WorkerPool(size_t threads);
+    // Finishes the queued tasks, then joins the threads
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // The future is ready once task has run and carries anything it threw
+    std::future<void> submit(Task task);
+
+    size_t size() const { return threads.size(); }
+    // std::thread::hardware_concurrency(), or 1 when that is unknown
+    static size_t defaultThreads();
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::packaged_task<void()>> tasks;
+    bool stopping;
+
+    void run();
+};
@@ -0,0 +1,111 @@
+#include "instrument.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace instrument {
+
+static const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "connect", "list_resolve", "encrypt", "send", "server_wait", "receive", "decrypt", "disk_write"
+};
+
+const char* phaseName(Phase phase) {
+    return phase < PHASE_COUNT ? PHASE_NAMES[phase] : "unknown";
+}
+
+#ifdef MESSAGEU_INSTRUMENT
+
+// Bucket b holds samples below 2^b ns; the last one also takes everything slower
+static constexpr int BUCKETS = 40;
+
+struct Counters {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> histogram[BUCKETS];
+};
+
+// Zero-initialised as a static, so recording needs no setup
+static Counters counters[PHASE_COUNT];
+
+static uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static int bucketFor(uint64_t ns) {
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && (ns >> bucket) != 0) {
+        bucket++;
+    }
+    return bucket;
+}
+
+void record(Phase phase, uint64_t elapsed_ns, uint64_t bytes) {
+    Counters& c = counters[phase];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+    c.histogram[bucketFor(elapsed_ns)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = c.max_ns.load(std::memory_order_relaxed);
+    while (elapsed_ns > max && !c.max_ns.compare_exchange_weak(max, elapsed_ns, std::memory_order_relaxed)) {
+    }
+}
+
+void reset() {
+    for (auto& c : counters) {
+        c.count = 0;
+        c.bytes = 0;
+        c.total_ns = 0;
+        c.max_ns = 0;
+        for (auto& bucket : c.histogram) {
+            bucket = 0;
+        }
+    }
+}
+
+void dump(std::ostream& out) {
+    out << "{\"enabled\": true, \"phases\": {";
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const Counters& c = counters[phase];
+        out << (phase ? ", " : "") << "\"" << PHASE_NAMES[phase] << "\": {"
+            << "\"count\": " << c.count.load(std::memory_order_relaxed)
+            << ", \"bytes\": " << c.bytes.load(std::memory_order_relaxed)
+            << ", \"total_ns\": " << c.total_ns.load(std::memory_order_relaxed)
+            << ", \"max_ns\": " << c.max_ns.load(std::memory_order_relaxed)
+            << ", \"histogram\": [";
+        bool first = true;
+        for (int bucket = 0; bucket < BUCKETS; bucket++) {
+            uint64_t samples = c.histogram[bucket].load(std::memory_order_relaxed);
+            if (samples == 0) {
+                continue;
+            }
+            out << (first ? "" : ", ") << "[" << (uint64_t(1) << bucket) << ", " << samples << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+    out << "}}" << std::endl;
+}
+
+ScopedTimer::ScopedTimer(Phase phase) : phase(phase), start_ns(nowNs()), bytes(0) {}
+
+ScopedTimer::~ScopedTimer() {
+    record(phase, nowNs() - start_ns, bytes);
+}
+
+#else
+
+void record(Phase, uint64_t, uint64_t) {}
+
+void reset() {}
+
+void dump(std::ostream& out) {
+    out << "{\"enabled\": false}" << std::endl;
+}
+
+#endif
+
+} // namespace instrument
@@ -0,0 +1,87 @@
+#include "keycache.h"
+#include "protocol.h"
+#include "message.h"
+#include "crypto/Base64Wrapper.h"
+#include "crypto/RSAPublicWrapper.h"
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+PublicKeyCache::PublicKeyCache(const std::string& path) : path(path) {}
+
+std::string PublicKeyCache::idKey(const uint8_t* client_id) {
+    return std::string(reinterpret_cast<const char*>(client_id), CLIENT_ID_SIZE);
+}
+
+size_t PublicKeyCache::load() {
+    std::ifstream file(path);
+    if (!file) {
+        return 0;
+    }
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string id_hex, key_b64;
+        if (!(fields >> id_hex >> key_b64) || id_hex.size() != CLIENT_ID_SIZE * 2) {
+            continue;
+        }
+        
+        try {
+            uint8_t client_id[CLIENT_ID_SIZE];
+            MessageUtils::hexToBytes(id_hex, client_id, CLIENT_ID_SIZE);
+            auto key = Base64Wrapper::decode(key_b64);
+            if (key.size() != PUBLIC_KEY_SIZE) {
+                continue;
+            }
+            
+            Entry& entry = entries[idKey(client_id)];
+            entry.key = key;
+            entry.wrapper.reset();
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping bad entry in " << path << ": " << e.what() << std::endl;
+        }
+    }
+    
+    return entries.size();
+}
+
+const std::vector<uint8_t>* PublicKeyCache::find(const uint8_t* client_id) const {
+    auto it = entries.find(idKey(client_id));
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    return &it->second.key;
+}
+
+void PublicKeyCache::put(const uint8_t* client_id, const std::vector<uint8_t>& public_key) {
+    Entry& entry = entries[idKey(client_id)];
+    if (entry.key == public_key) {
+        return;
+    }
+    
+    entry.key = public_key;
+    entry.wrapper.reset();
+    
+    std::ofstream file(path, std::ios::app);
+    if (!file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return;
+    }
+    file << MessageUtils::bytesToHex(client_id, CLIENT_ID_SIZE) << " "
+         << Base64Wrapper::encode(public_key) << std::endl;
+}
+
+std::shared_ptr<RSAPublicWrapper> PublicKeyCache::getWrapper(const uint8_t* client_id) {
+    auto it = entries.find(idKey(client_id));
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    
+    Entry& entry = it->second;
+    if (!entry.wrapper) {
+        entry.wrapper = std::make_shared<RSAPublicWrapper>(entry.key);
+    }
+    return entry.wrapper;
+}
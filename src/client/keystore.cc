@@ -0,0 +1,276 @@
+#include "keystore.h"
+#include "crypto/AESWrapper.h"
+#include "crypto/RSAPrivateWrapper.h"
+#include "crypto/RSAPublicWrapper.h"
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr size_t SymmetricKeyStore::KEY_SIZE;
+
+static constexpr size_t INITIAL_CAPACITY = 16;
+
+static const uint8_t KEY_FILE_MAGIC[4] = {'M', 'U', 'K', '1'};
+static constexpr size_t KEY_FILE_HEADER_SIZE = 8;
+
+SealedKeyFile::SealedKeyFile(const std::string& path, RSAPrivateWrapper& owner, bool fresh)
+    : path(path), owner(owner), sealer(new RSAPublicWrapper(owner.getPublicKey())),
+      fd(-1), map(nullptr), map_size(0), sealed_size(0), record_count(0) {
+    // Holds secrets, so owner-only like an ssh key
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (fresh ? O_TRUNC : 0), 0600);
+    if (fd < 0) {
+        std::cerr << "Could not open " << path << ": " << std::strerror(errno)
+                  << " (symmetric keys won't be saved)" << std::endl;
+        return;
+    }
+
+    struct stat st;
+    size_t file_size = fstat(fd, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    if (!readHeader(file_size)) {
+        if (file_size > 0) {
+            std::cerr << "Ignoring unreadable " << path << "; saved symmetric keys are lost" << std::endl;
+        }
+        writeHeader();
+        return;
+    }
+
+    record_count = (file_size - KEY_FILE_HEADER_SIZE) / recordSize();
+    size_t used_size = KEY_FILE_HEADER_SIZE + record_count * recordSize();
+    if (used_size < file_size) {
+        // A torn append from a crash; drop it so new records stay aligned
+        if (ftruncate(fd, static_cast<off_t>(used_size)) != 0) {
+            std::cerr << "Could not repair " << path << std::endl;
+        }
+    }
+    if (record_count == 0) {
+        return;
+    }
+
+    void* mapped = mmap(nullptr, used_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Could not map " << path << ": " << std::strerror(errno) << std::endl;
+        record_count = 0;
+        return;
+    }
+    map = static_cast<const uint8_t*>(mapped);
+    map_size = used_size;
+}
+
+SealedKeyFile::~SealedKeyFile() {
+    if (map) {
+        munmap(const_cast<uint8_t*>(map), map_size);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool SealedKeyFile::readHeader(size_t file_size) {
+    uint8_t header[KEY_FILE_HEADER_SIZE];
+    if (file_size < sizeof(header) || pread(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        return false;
+    }
+    if (std::memcmp(header, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC)) != 0) {
+        return false;
+    }
+
+    sealed_size = header[4] | (header[5] << 8) | (header[6] << 16) | (static_cast<uint32_t>(header[7]) << 24);
+    return sealed_size > 0 && sealed_size <= 4096;
+}
+
+void SealedKeyFile::writeHeader() {
+    // The sealed size depends on the key pair; find it out once
+    sealed_size = sealer->encrypt(std::vector<uint8_t>(SymmetricKeyStore::KEY_SIZE)).size();
+
+    uint8_t header[KEY_FILE_HEADER_SIZE];
+    std::memcpy(header, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC));
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = static_cast<uint8_t>(sealed_size >> (8 * i));
+    }
+
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        std::cerr << "Could not write " << path << " (symmetric keys won't be saved)" << std::endl;
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+const uint8_t* SealedKeyFile::recordId(size_t index) const {
+    return map + KEY_FILE_HEADER_SIZE + index * recordSize();
+}
+
+std::vector<uint8_t> SealedKeyFile::unseal(size_t index) const {
+    const uint8_t* sealed = recordId(index) + CLIENT_ID_SIZE;
+    return owner.decrypt(std::vector<uint8_t>(sealed, sealed + sealed_size));
+}
+
+void SealedKeyFile::append(const uint8_t* client_id, const std::vector<uint8_t>& key) {
+    if (fd < 0) {
+        return;
+    }
+
+    auto sealed = sealer->encrypt(key);
+    if (sealed.size() != sealed_size) {
+        std::cerr << path << " was written for another key pair; not saving this key" << std::endl;
+        return;
+    }
+
+    // One write per record, at the end; the mapping keeps its original extent
+    std::vector<uint8_t> record(client_id, client_id + CLIENT_ID_SIZE);
+    record.insert(record.end(), sealed.begin(), sealed.end());
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < 0 || pwrite(fd, record.data(), record.size(), end) != static_cast<ssize_t>(record.size())) {
+        std::cerr << "Could not save symmetric key to " << path << std::endl;
+    }
+}
+
+// Server-assigned IDs are random, so folding the two halves together and
+// spreading them with a multiply is enough
+static size_t hashId(const uint8_t* client_id) {
+    uint64_t low, high;
+    std::memcpy(&low, client_id, sizeof(low));
+    std::memcpy(&high, client_id + sizeof(low), sizeof(high));
+    uint64_t h = (low ^ high) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+SymmetricKeyStore::SymmetricKeyStore() : slots(INITIAL_CAPACITY), count(0), indexed(true) {}
+
+SymmetricKeyStore::~SymmetricKeyStore() = default;
+
+void SymmetricKeyStore::attach(const std::string& path, RSAPrivateWrapper& owner, bool fresh) {
+    if (fresh) {
+        // Keys negotiated under the previous identity are useless now
+        std::vector<Slot>(INITIAL_CAPACITY).swap(slots);
+        count = 0;
+    }
+    file.reset(new SealedKeyFile(path, owner, fresh));
+    indexed = false;
+}
+
+size_t SymmetricKeyStore::probe(const uint8_t* client_id) const {
+    size_t mask = slots.size() - 1;
+    size_t index = hashId(client_id) & mask;
+    // The table is never full (see claim), so this finds an empty slot at worst
+    while (slots[index].state != SLOT_EMPTY && std::memcmp(slots[index].id, client_id, CLIENT_ID_SIZE) != 0) {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+size_t SymmetricKeyStore::claim(const uint8_t* client_id) {
+    // Keep the load factor under 3/4 so probe sequences stay short
+    if ((count + 1) * 4 > slots.size() * 3) {
+        grow();
+    }
+    return probe(client_id);
+}
+
+void SymmetricKeyStore::indexFile() {
+    indexed = true;
+    for (size_t record = 0; record < file->recordCount(); record++) {
+        const uint8_t* client_id = file->recordId(record);
+        Slot& slot = slots[claim(client_id)];
+        if (slot.state == SLOT_EMPTY) {
+            std::memcpy(slot.id, client_id, CLIENT_ID_SIZE);
+            count++;
+        } else if (slot.state == SLOT_READY) {
+            // Set in this session before the first lookup; newer than the file
+            continue;
+        }
+        slot.state = SLOT_SEALED;
+        slot.record = static_cast<uint32_t>(record);
+    }
+}
+
+SymmetricKeyStore::Slot* SymmetricKeyStore::ready(const uint8_t* client_id) {
+    if (!indexed) {
+        indexFile();
+    }
+
+    Slot& slot = slots[probe(client_id)];
+    if (slot.state == SLOT_SEALED) {
+        try {
+            auto key = file->unseal(slot.record);
+            if (key.size() != KEY_SIZE) {
+                throw std::runtime_error("wrong key size");
+            }
+            std::memcpy(slot.key, key.data(), KEY_SIZE);
+            slot.state = SLOT_READY;
+        } catch (const std::exception& e) {
+            std::cerr << "Could not unseal saved symmetric key: " << e.what() << std::endl;
+            slot.state = SLOT_BROKEN;
+        }
+    }
+    return slot.state == SLOT_READY ? &slot : nullptr;
+}
+
+bool SymmetricKeyStore::contains(const uint8_t* client_id) {
+    if (!indexed) {
+        indexFile();
+    }
+    SlotState state = slots[probe(client_id)].state;
+    return state == SLOT_READY || state == SLOT_SEALED;
+}
+
+const uint8_t* SymmetricKeyStore::find(const uint8_t* client_id) {
+    Slot* slot = ready(client_id);
+    return slot ? slot->key : nullptr;
+}
+
+void SymmetricKeyStore::put(const uint8_t* client_id, const std::vector<uint8_t>& key) {
+    if (key.size() != KEY_SIZE) {
+        throw std::runtime_error("Invalid symmetric key size");
+    }
+
+    if (!indexed) {
+        indexFile();
+    }
+
+    // A still-sealed key is simply superseded; no need to decrypt it to compare
+    Slot& slot = slots[claim(client_id)];
+    if (slot.state == SLOT_READY && std::memcmp(slot.key, key.data(), KEY_SIZE) == 0) {
+        return;
+    }
+    if (slot.state == SLOT_EMPTY) {
+        std::memcpy(slot.id, client_id, CLIENT_ID_SIZE);
+        count++;
+    }
+    std::memcpy(slot.key, key.data(), KEY_SIZE);
+    slot.state = SLOT_READY;
+    slot.aes.reset();
+
+    if (file) {
+        file->append(client_id, key);
+    }
+}
+
+AESWrapper* SymmetricKeyStore::cipher(const uint8_t* client_id) {
+    Slot* slot = ready(client_id);
+    if (!slot) {
+        return nullptr;
+    }
+    if (!slot->aes) {
+        slot->aes.reset(new AESWrapper(std::vector<uint8_t>(slot->key, slot->key + KEY_SIZE)));
+    }
+    return slot->aes.get();
+}
+
+void SymmetricKeyStore::grow() {
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+
+    for (auto& entry : old) {
+        if (entry.state == SLOT_EMPTY) {
+            continue;
+        }
+        Slot& slot = slots[probe(entry.id)];
+        slot = std::move(entry);
+    }
+}
@@ -0,0 +1,531 @@
+#include "connection.h"
+#include "protocol.h"
+#include "message.h"
+#include "crypto/AESWrapper.h"
+#include "crypto/RSAPrivateWrapper.h"
+#include "crypto/RSAPublicWrapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// messageu-loadgen: simulates many registered clients against a running server
+// and reports per request code throughput and latency percentiles. Each
+// simulated client keeps its own connection, as a real client would; worker
+// threads take turns driving the clients they own.
+
+typedef std::chrono::steady_clock Clock;
+
+enum Operation { OP_REGISTER, OP_LIST, OP_KEY_EXCHANGE, OP_TEXT, OP_FILE, OP_FETCH, OP_COUNT };
+
+static const char* const OPERATION_NAMES[OP_COUNT] = {"register", "list", "keyx", "text", "file", "fetch"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 1357;
+    size_t clients = 1000;
+    size_t threads = 8;
+    double duration_seconds = 10;
+    size_t text_size = 64;
+    size_t file_size = 16 * 1024;
+    bool unique_keys = false;
+    // Prefix for client names, so runs against the same database don't collide
+    std::string run_tag;
+    unsigned weights[OP_COUNT] = {1, 5, 5, 55, 4, 30};
+};
+
+// Immutable once the registration phase is over, so any worker may pick any
+// registered client as a peer
+struct Identity {
+    std::string name;
+    uint8_t id[CLIENT_ID_SIZE];
+    bool registered;
+};
+
+struct SimClient {
+    size_t identity;
+    std::unique_ptr<Connection> connection;
+    uint32_t cursor;
+    std::vector<uint8_t> aes_key;
+};
+
+struct Samples {
+    std::vector<uint32_t> latencies_us;
+    uint64_t errors = 0;
+};
+
+class Recorder {
+public:
+    std::map<uint16_t, Samples> by_code;
+
+    void record(uint16_t code, Clock::duration elapsed, bool ok) {
+        Samples& samples = by_code[code];
+        if (!ok) {
+            samples.errors++;
+            return;
+        }
+        samples.latencies_us.push_back(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+    }
+
+    void merge(const Recorder& other) {
+        for (const auto& entry : other.by_code) {
+            Samples& samples = by_code[entry.first];
+            samples.latencies_us.insert(samples.latencies_us.end(), entry.second.latencies_us.begin(),
+                                        entry.second.latencies_us.end());
+            samples.errors += entry.second.errors;
+        }
+    }
+};
+
+class Worker {
+public:
+    Worker(const Options& options, std::vector<Identity>& identities, size_t index)
+        : options(options), identities(identities), index(index), random(std::random_device{}() + index) {}
+
+    void addClient(size_t identity) {
+        SimClient client;
+        client.identity = identity;
+        client.connection.reset(new Connection());
+        client.connection->setQuiet(true);
+        client.connection->setEndpoint(options.host, options.port);
+        client.cursor = 0;
+        client.aes_key = AESWrapper::generateKey();
+        clients.push_back(std::move(client));
+    }
+
+    void registerAll() {
+        for (auto& client : clients) {
+            registerClient(client);
+        }
+    }
+
+    void runMix(Clock::time_point deadline, std::atomic<uint64_t>& operations) {
+        unsigned total_weight = 0;
+        for (unsigned weight : options.weights) {
+            total_weight += weight;
+        }
+        if (total_weight == 0 || clients.empty()) {
+            return;
+        }
+
+        std::vector<uint8_t> text(options.text_size, 't');
+        std::vector<uint8_t> file(options.file_size);
+        for (auto& byte : file) {
+            byte = static_cast<uint8_t>(random());
+        }
+
+        size_t next = 0;
+        while (Clock::now() < deadline) {
+            SimClient& client = clients[next++ % clients.size()];
+            if (!identities[client.identity].registered) {
+                continue;
+            }
+
+            unsigned pick = random() % total_weight;
+            int op = 0;
+            while (pick >= options.weights[op]) {
+                pick -= options.weights[op];
+                op++;
+            }
+
+            switch (op) {
+                case OP_REGISTER: registerNew(); break;
+                case OP_LIST: list(client); break;
+                case OP_KEY_EXCHANGE: keyExchange(client); break;
+                case OP_TEXT: sendContent(client, MSG_TYPE_TEXT_MESSAGE, text); break;
+                case OP_FILE: sendFile(client, file); break;
+                case OP_FETCH: fetch(client); break;
+            }
+            operations++;
+        }
+    }
+
+    // Hands over what was recorded since the last call
+    Recorder takeResults() {
+        Recorder results;
+        std::swap(results, recorder);
+        return results;
+    }
+
+private:
+    const Options& options;
+    std::vector<Identity>& identities;
+    size_t index;
+    std::mt19937 random;
+    std::vector<SimClient> clients;
+    Recorder recorder;
+    std::unique_ptr<RSAPrivateWrapper> shared_key;
+    size_t extra_registrations = 0;
+
+    // Sends prefix + content and reads the whole response; true if it carried expected_code
+    bool exchange(SimClient& client, uint16_t code, uint16_t expected_code, const uint8_t* prefix,
+                  size_t prefix_size, const std::vector<uint8_t>& content, std::vector<uint8_t>& payload) {
+        Connection& connection = *client.connection;
+        auto start = Clock::now();
+
+        bool ok = connection.acquire() &&
+                  connection.sendGather(prefix, prefix_size, content.data(), content.size());
+
+        if (ok) {
+            std::vector<uint8_t> header(7);
+            ok = connection.recvAll(header.data(), header.size());
+            if (ok) {
+                ResponseHeader resp_header = Protocol::unpackResponseHeader(header);
+                payload.resize(resp_header.payload_size);
+                ok = payload.empty() || connection.recvAll(payload.data(), payload.size());
+                ok = ok && resp_header.code == expected_code;
+            }
+        }
+        if (!ok && !connection.isAlive()) {
+            connection.close();
+        }
+
+        recorder.record(code, Clock::now() - start, ok);
+        return ok;
+    }
+
+    bool exchange(SimClient& client, uint16_t code, uint16_t expected_code,
+                  const std::vector<uint8_t>& request, std::vector<uint8_t>& payload) {
+        return exchange(client, code, expected_code, request.data(), request.size(),
+                        std::vector<uint8_t>(), payload);
+    }
+
+    const Identity& self(const SimClient& client) const {
+        return identities[client.identity];
+    }
+
+    const Identity* pickPeer() {
+        for (int attempt = 0; attempt < 8; attempt++) {
+            const Identity& peer = identities[random() % identities.size()];
+            if (peer.registered) {
+                return &peer;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<uint8_t> publicKey() {
+        // RSA key generation would dominate the run, so by default one key pair
+        // serves all of a worker's clients
+        if (options.unique_keys || !shared_key) {
+            shared_key.reset(new RSAPrivateWrapper());
+        }
+        return shared_key->getPublicKey();
+    }
+
+    void registerClient(SimClient& client) {
+        Identity& identity = identities[client.identity];
+        auto request = Protocol::packRegisterRequest(identity.name, publicKey());
+        std::vector<uint8_t> payload;
+        if (exchange(client, REQ_REGISTER, RES_REGISTRATION_SUCCESS, request, payload) &&
+            payload.size() >= CLIENT_ID_SIZE) {
+            std::memcpy(identity.id, payload.data(), CLIENT_ID_SIZE);
+            identity.registered = true;
+        }
+    }
+
+    // A newcomer: registers over a connection of its own and then goes away,
+    // so it never becomes a peer
+    void registerNew() {
+        SimClient client;
+        client.connection.reset(new Connection());
+        client.connection->setQuiet(true);
+        client.connection->setEndpoint(options.host, options.port);
+
+        std::string name = options.run_tag + "-w" + std::to_string(index) + "-" +
+                           std::to_string(++extra_registrations);
+        auto request = Protocol::packRegisterRequest(name, publicKey());
+        std::vector<uint8_t> payload;
+        exchange(client, REQ_REGISTER, RES_REGISTRATION_SUCCESS, request, payload);
+    }
+
+    void list(SimClient& client) {
+        auto request = Protocol::packClientListSinceRequest(self(client).id, client.cursor);
+        std::vector<uint8_t> payload;
+        if (exchange(client, REQ_CLIENT_LIST_SINCE, RES_CLIENT_LIST_SINCE, request, payload)) {
+            MessageUtils::parseClientListSince(payload, &client.cursor);
+        }
+    }
+
+    void keyExchange(SimClient& client) {
+        const Identity* peer = pickPeer();
+        if (!peer) {
+            return;
+        }
+
+        auto lookup = Protocol::packLookupRequest(self(client).id, std::vector<std::string>(1, peer->name));
+        std::vector<uint8_t> payload;
+        if (!exchange(client, REQ_LOOKUP_CLIENTS, RES_LOOKUP_CLIENTS, lookup, payload)) {
+            return;
+        }
+        auto results = MessageUtils::parseLookupResponse(payload);
+        if (results.empty() || !results[0].found) {
+            return;
+        }
+
+        RSAPublicWrapper peer_key(results[0].public_key);
+        auto encrypted_key = peer_key.encrypt(client.aes_key);
+        auto request = Protocol::packSendMessageRequest(self(client).id, peer->id, MSG_TYPE_SYM_KEY_SEND,
+                                                        encrypted_key);
+        exchange(client, REQ_SEND_MESSAGE, RES_MESSAGE_SENT, request, payload);
+    }
+
+    void sendContent(SimClient& client, uint8_t type, const std::vector<uint8_t>& plaintext) {
+        const Identity* peer = pickPeer();
+        if (!peer) {
+            return;
+        }
+
+        AESWrapper aes(client.aes_key);
+        auto encrypted = aes.encrypt(plaintext);
+        uint8_t prefix[SEND_MESSAGE_PREFIX_SIZE];
+        Protocol::packSendMessagePrefix(prefix, self(client).id, peer->id, type, encrypted.size());
+        std::vector<uint8_t> payload;
+        exchange(client, REQ_SEND_MESSAGE, RES_MESSAGE_SENT, prefix, sizeof(prefix), encrypted, payload);
+    }
+
+    void sendFile(SimClient& client, const std::vector<uint8_t>& file) {
+        if (file.size() <= FILE_CHUNK_SIZE) {
+            sendContent(client, MSG_TYPE_FILE, file);
+            return;
+        }
+
+        const Identity* peer = pickPeer();
+        if (!peer) {
+            return;
+        }
+
+        AESWrapper aes(client.aes_key);
+        uint32_t transfer_id = random();
+        uint32_t chunk_count = static_cast<uint32_t>((file.size() + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE);
+        std::vector<uint8_t> payload;
+
+        for (uint32_t index = 0; index < chunk_count; index++) {
+            size_t begin = index * FILE_CHUNK_SIZE;
+            size_t end = std::min(file.size(), begin + FILE_CHUNK_SIZE);
+            std::vector<uint8_t> encrypted(AESWrapper::framedSize(end - begin));
+            std::copy(file.begin() + begin, file.begin() + end, encrypted.begin() + AESWrapper::IV_SIZE);
+            encrypted.resize(aes.encryptFramed(encrypted.data(), end - begin));
+
+            uint8_t prefix[FILE_CHUNK_PREFIX_SIZE];
+            Protocol::packFileChunkPrefix(prefix, self(client).id, peer->id, transfer_id, index,
+                                          index + 1 == chunk_count, false, encrypted.size());
+            if (!exchange(client, REQ_SEND_FILE_CHUNK_IV, RES_FILE_CHUNK_STORED, prefix, sizeof(prefix),
+                          encrypted, payload)) {
+                return;
+            }
+        }
+    }
+
+    void fetch(SimClient& client) {
+        auto request = Protocol::packWaitingMessagesRequest(self(client).id);
+        std::vector<uint8_t> payload;
+        if (!exchange(client, REQ_WAITING_MESSAGES, RES_WAITING_MESSAGES, request, payload)) {
+            return;
+        }
+
+        // Pull the chunks of any chunked files, as the real client does
+        std::vector<uint8_t> chunk;
+        for (const auto& msg : MessageUtils::viewMessages(payload)) {
+            if (!MessageUtils::isChunkedFile(msg.type)) {
+                continue;
+            }
+            std::vector<uint8_t> content(msg.content, msg.content + msg.content_size);
+            FileDescriptor descriptor = MessageUtils::parseFileDescriptor(content);
+            for (uint32_t index = 0; index < descriptor.chunk_count; index++) {
+                auto fetch_request = Protocol::packFetchFileChunkRequest(self(client).id, msg.id, index);
+                if (!exchange(client, REQ_FETCH_FILE_CHUNK, RES_FILE_CHUNK, fetch_request, chunk)) {
+                    break;
+                }
+            }
+        }
+    }
+};
+
+static const char* codeName(uint16_t code) {
+    switch (code) {
+        case REQ_REGISTER: return "register";
+        case REQ_CLIENT_LIST_SINCE: return "client list since";
+        case REQ_LOOKUP_CLIENTS: return "lookup";
+        case REQ_SEND_MESSAGE: return "send message";
+        case REQ_WAITING_MESSAGES: return "waiting messages";
+        case REQ_SEND_FILE_CHUNK_IV: return "send file chunk";
+        case REQ_FETCH_FILE_CHUNK: return "fetch file chunk";
+        default: return "other";
+    }
+}
+
+static double percentile(const std::vector<uint32_t>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static void report(Recorder& recorder, double seconds) {
+    std::cout << std::left << std::setw(6) << "code" << std::setw(20) << "request"
+              << std::right << std::setw(10) << "count" << std::setw(8) << "errors"
+              << std::setw(10) << "req/s" << std::setw(10) << "p50 us"
+              << std::setw(10) << "p99 us" << std::setw(10) << "p999 us" << std::endl;
+
+    for (auto& entry : recorder.by_code) {
+        std::vector<uint32_t>& latencies = entry.second.latencies_us;
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << std::left << std::setw(6) << entry.first << std::setw(20) << codeName(entry.first)
+                  << std::right << std::setw(10) << latencies.size() << std::setw(8) << entry.second.errors
+                  << std::setw(10) << std::fixed << std::setprecision(1) << latencies.size() / seconds
+                  << std::setw(10) << std::setprecision(0) << percentile(latencies, 0.50)
+                  << std::setw(10) << percentile(latencies, 0.99)
+                  << std::setw(10) << percentile(latencies, 0.999) << std::endl;
+    }
+}
+
+static bool parseMix(const std::string& mix, unsigned* weights) {
+    std::fill(weights, weights + OP_COUNT, 0u);
+    std::istringstream stream(mix);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string name = item.substr(0, equals);
+        int op = 0;
+        while (op < OP_COUNT && name != OPERATION_NAMES[op]) {
+            op++;
+        }
+        if (op == OP_COUNT) {
+            return false;
+        }
+        weights[op] = static_cast<unsigned>(std::atoi(item.c_str() + equals + 1));
+    }
+    return true;
+}
+
+static int usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --host <ip>          server address (127.0.0.1)\n"
+              << "  --port <port>        server port (1357)\n"
+              << "  --clients <n>        simulated clients to register (1000)\n"
+              << "  --threads <n>        worker threads (8)\n"
+              << "  --duration <s>       length of the mixed phase (10)\n"
+              << "  --mix <op=w,...>     weights for register, list, keyx, text, file, fetch\n"
+              << "                       (register=1,list=5,keyx=5,text=55,file=4,fetch=30)\n"
+              << "  --text-size <bytes>  plaintext size of text messages (64)\n"
+              << "  --file-size <bytes>  size of sent files; above one chunk they go chunked (16384)\n"
+              << "  --unique-keys        generate an RSA key pair per client" << std::endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--host" && has_value) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && has_value) {
+            options.port = std::atoi(argv[++i]);
+        } else if (arg == "--clients" && has_value) {
+            options.clients = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && has_value) {
+            options.threads = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--duration" && has_value) {
+            options.duration_seconds = std::atof(argv[++i]);
+        } else if (arg == "--mix" && has_value) {
+            if (!parseMix(argv[++i], options.weights)) {
+                return usage(argv[0]);
+            }
+        } else if (arg == "--text-size" && has_value) {
+            options.text_size = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--file-size" && has_value) {
+            options.file_size = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--unique-keys") {
+            options.unique_keys = true;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (options.clients == 0) {
+        return usage(argv[0]);
+    }
+
+    std::random_device random;
+    options.run_tag = "lg" + std::to_string(random() % 1000000);
+    std::vector<Identity> identities(options.clients);
+    for (size_t i = 0; i < identities.size(); i++) {
+        identities[i].name = options.run_tag + "-" + std::to_string(i);
+        identities[i].registered = false;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t t = 0; t < options.threads; t++) {
+        workers.emplace_back(new Worker(options, identities, t));
+    }
+    for (size_t i = 0; i < identities.size(); i++) {
+        workers[i % workers.size()]->addClient(i);
+    }
+
+    // Runs body on every worker in parallel and collects what they recorded
+    auto runPhase = [&](std::function<void(Worker&)> body, Recorder& results) {
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (auto& worker : workers) {
+            Worker* w = worker.get();
+            threads.emplace_back([w, &body]() { body(*w); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (auto& worker : workers) {
+            results.merge(worker->takeResults());
+        }
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    std::cout << "Registering " << options.clients << " clients on " << options.threads << " threads against "
+              << options.host << ":" << options.port << std::endl;
+    Recorder registration;
+    double seconds = runPhase([](Worker& worker) { worker.registerAll(); }, registration);
+
+    size_t registered = std::count_if(identities.begin(), identities.end(),
+                                      [](const Identity& identity) { return identity.registered; });
+    std::cout << registered << " of " << options.clients << " clients registered in "
+              << std::fixed << std::setprecision(2) << seconds << " s\n" << std::endl;
+    report(registration, seconds);
+    if (registered == 0) {
+        return 1;
+    }
+
+    std::cout << "\nMixed load for " << options.duration_seconds << " s (";
+    for (int op = 0; op < OP_COUNT; op++) {
+        std::cout << (op ? "," : "") << OPERATION_NAMES[op] << "=" << options.weights[op];
+    }
+    std::cout << ")" << std::endl;
+
+    std::atomic<uint64_t> operations(0);
+    auto deadline = Clock::now() + std::chrono::milliseconds(static_cast<int64_t>(options.duration_seconds * 1000));
+    Recorder mixed;
+    seconds = runPhase([&](Worker& worker) { worker.runMix(deadline, operations); }, mixed);
+
+    std::cout << operations << " operations (" << std::fixed << std::setprecision(1)
+              << operations / seconds << " ops/s)\n" << std::endl;
+    report(mixed, seconds);
+    return 0;
+}
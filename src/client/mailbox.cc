@@ -0,0 +1,109 @@
+#include "mailbox.h"
+#include "connection.h"
+#include "protocol.h"
+#include "instrument.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+constexpr size_t MailboxReader::READ_BLOCK_SIZE;
+
+// from_client + message id + type + content size
+static constexpr size_t MESSAGE_HEADER_SIZE = CLIENT_ID_SIZE + 4 + 1 + 4;
+
+MailboxReader::MailboxReader(Connection& connection, uint32_t payload_size)
+    : connection(connection), payload_remaining(payload_size),
+      content_remaining(0), content_size(0), last_id(0) {}
+
+MailboxReader::~MailboxReader() {
+    if (payload_remaining > 0) {
+        connection.close();
+    }
+}
+
+void MailboxReader::read(uint8_t* data, size_t length) {
+    if (length > payload_remaining) {
+        connection.close();
+        throw std::runtime_error("Message exceeds response payload");
+    }
+    INSTRUMENT_TIMER(timer, instrument::PHASE_RECEIVE);
+    INSTRUMENT_ADD_BYTES(timer, length);
+    if (!connection.recvAll(data, length)) {
+        connection.close();
+        throw std::runtime_error("Failed to receive waiting messages");
+    }
+    payload_remaining -= length;
+}
+
+bool MailboxReader::next(Message& msg) {
+    skipContent();
+    
+    if (payload_remaining < MESSAGE_HEADER_SIZE) {
+        // Trailing bytes too short to be a message; drop them like parseMessages does
+        if (payload_remaining > 0) {
+            std::vector<uint8_t> trailing(static_cast<size_t>(payload_remaining));
+            read(trailing.data(), trailing.size());
+        }
+        return false;
+    }
+    
+    uint8_t header[MESSAGE_HEADER_SIZE];
+    read(header, MESSAGE_HEADER_SIZE);
+    
+    size_t offset = 0;
+    std::memcpy(msg.from_client, header, CLIENT_ID_SIZE);
+    offset += CLIENT_ID_SIZE;
+    
+    msg.id = header[offset] | (header[offset + 1] << 8) |
+             (header[offset + 2] << 16) | (static_cast<uint32_t>(header[offset + 3]) << 24);
+    offset += 4;
+    
+    msg.type = header[offset];
+    offset += 1;
+    
+    content_size = header[offset] | (header[offset + 1] << 8) |
+                   (header[offset + 2] << 16) | (static_cast<uint32_t>(header[offset + 3]) << 24);
+    if (content_size > payload_remaining) {
+        // Checked here so callers can size buffers from contentSize()
+        connection.close();
+        payload_remaining = 0;
+        throw std::runtime_error("Message content exceeds response payload");
+    }
+    content_remaining = content_size;
+    last_id = msg.id;
+    msg.content.clear();
+    
+    return true;
+}
+
+void MailboxReader::readContent(std::vector<uint8_t>& out) {
+    out.resize(content_remaining);
+    if (content_remaining > 0) {
+        read(out.data(), content_remaining);
+    }
+    content_remaining = 0;
+}
+
+void MailboxReader::streamContent(const std::function<void(const uint8_t*, size_t)>& sink) {
+    std::vector<uint8_t> block(std::min(static_cast<size_t>(content_remaining), READ_BLOCK_SIZE));
+    while (content_remaining > 0) {
+        size_t length = std::min(static_cast<size_t>(content_remaining), block.size());
+        read(block.data(), length);
+        content_remaining -= length;
+        sink(block.data(), length);
+    }
+}
+
+void MailboxReader::skipContent() {
+    if (content_remaining == 0) {
+        return;
+    }
+    
+    std::vector<uint8_t> block(std::min(static_cast<size_t>(content_remaining), READ_BLOCK_SIZE));
+    while (content_remaining > 0) {
+        size_t length = std::min(static_cast<size_t>(content_remaining), block.size());
+        read(block.data(), length);
+        content_remaining -= length;
+    }
+}
@@ -1,15 +1,113 @@
 #include "client.h"
+#include "instrument.h"
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 
-int main() {
+static int usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--per-request] [--poll <seconds> | --push] [--crypto-threads <n>] [--connections <n>] [--script <file|->] [--timings <file|->]" << std::endl;
+    return 1;
+}
+
+// A whole number from min to max, digits only; false for anything else
+static bool parseNumber(const char* text, unsigned long min, unsigned long max, unsigned long& value) {
+    // strtoul would also take leading spaces and a sign
+    if (!std::isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text, &end, 10);
+    if (errno != 0 || *end != '\0' || parsed < min || parsed > max) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Counters at exit; "-" means stderr, since stdout carries script results
+static void writeTimings(const char* path) {
+    if (std::strcmp(path, "-") == 0) {
+        instrument::dump(std::cerr);
+        return;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Could not write " << path << std::endl;
+        return;
+    }
+    instrument::dump(out);
+}
+
+int main(int argc, char* argv[]) {
+    bool persistent = true;
+    const char* script_path = nullptr;
+    unsigned poll_seconds = 0;
+    bool push = false;
+    unsigned crypto_threads = 0;
+    size_t max_connections = ConnectionPool::DEFAULT_MAX_CONNECTIONS;
+    const char* timings_path = nullptr;
+    unsigned long value = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--per-request") == 0) {
+            persistent = false;
+        } else if (std::strcmp(argv[i], "--poll") == 0 && i + 1 < argc) {
+            // At most a day; 0 turns polling off
+            if (!parseNumber(argv[++i], 0, 86400, value)) {
+                return usage(argv[0]);
+            }
+            poll_seconds = static_cast<unsigned>(value);
+        } else if (std::strcmp(argv[i], "--push") == 0) {
+            push = true;
+        } else if (std::strcmp(argv[i], "--crypto-threads") == 0 && i + 1 < argc) {
+            if (!parseNumber(argv[++i], 0, 1024, value)) {
+                return usage(argv[0]);
+            }
+            crypto_threads = static_cast<unsigned>(value);
+        } else if (std::strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            if (!parseNumber(argv[++i], 1, 1024, value)) {
+                return usage(argv[0]);
+            }
+            max_connections = static_cast<size_t>(value);
+        } else if (std::strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            script_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--timings") == 0 && i + 1 < argc) {
+            timings_path = argv[++i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    
     try {
-        MessageUClient client;
-        client.run();
+        MessageUClient client(persistent);
+        client.setPollInterval(poll_seconds);
+        client.setPushReceive(push);
+        client.setCryptoThreads(crypto_threads);
+        client.setMaxConnections(max_connections);
+        
+        int status = 0;
+        if (!script_path) {
+            client.run();
+        } else if (std::strcmp(script_path, "-") == 0) {
+            status = client.runScript(std::cin, std::cout) == 0 ? 0 : 2;
+        } else {
+            std::ifstream script(script_path);
+            if (!script) {
+                std::cerr << "Could not open " << script_path << std::endl;
+                return 1;
+            }
+            status = client.runScript(script, std::cout) == 0 ? 0 : 2;
+        }
+        
+        if (timings_path) {
+            writeTimings(timings_path);
+        }
+        return status;
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
         return 1;
     }
-    
-    return 0;
 }
-
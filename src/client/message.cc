@@ -1,29 +1,88 @@
 #include "message.h"
 #include "protocol.h"
+#include "crypto/AESWrapper.h"
 #include <cstring>
+#include <stdexcept>
 #include <sstream>
 #include <iomanip>
 
-std::vector<ClientInfo> MessageUtils::parseClientList(const std::vector<uint8_t>& payload) {
+static uint32_t readUint32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+           (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool decodeView(const uint8_t* data, size_t remaining, ClientInfoView& view, size_t& consumed) {
+    if (remaining < CLIENT_ID_SIZE + USERNAME_MAX_SIZE) {
+        return false;
+    }
+    
+    view.id = data;
+    view.name = reinterpret_cast<const char*>(data + CLIENT_ID_SIZE);
+    // Bounded so a name field without a terminator can't run past the entry
+    const void* terminator = std::memchr(view.name, '\0', USERNAME_MAX_SIZE);
+    view.name_length = terminator
+        ? static_cast<const char*>(terminator) - view.name
+        : USERNAME_MAX_SIZE;
+    
+    consumed = CLIENT_ID_SIZE + USERNAME_MAX_SIZE;
+    return true;
+}
+
+bool decodeView(const uint8_t* data, size_t remaining, MessageView& view, size_t& consumed) {
+    const size_t header_size = CLIENT_ID_SIZE + 4 + 1 + 4;
+    if (remaining < header_size) {
+        return false;
+    }
+    
+    view.from_client = data;
+    view.id = readUint32(data + CLIENT_ID_SIZE);
+    view.type = data[CLIENT_ID_SIZE + 4];
+    view.content_size = readUint32(data + CLIENT_ID_SIZE + 5);
+    view.content = data + header_size;
+    
+    if (view.content_size > remaining - header_size) {
+        return false;
+    }
+    
+    consumed = header_size + view.content_size;
+    return true;
+}
+
+static std::vector<ClientInfo> copyClients(const ClientListView& view, size_t size_hint) {
     std::vector<ClientInfo> clients;
+    clients.reserve(size_hint / (CLIENT_ID_SIZE + USERNAME_MAX_SIZE));
     
-    size_t offset = 0;
-    while (offset + CLIENT_ID_SIZE + USERNAME_MAX_SIZE <= payload.size()) {
+    for (const auto& entry : view) {
         ClientInfo client;
-        
-        std::memcpy(client.id, payload.data() + offset, CLIENT_ID_SIZE);
-        offset += CLIENT_ID_SIZE;
-        
-        const char* name_ptr = reinterpret_cast<const char*>(payload.data() + offset);
-        client.name = std::string(name_ptr);
-        offset += USERNAME_MAX_SIZE;
-        
+        std::memcpy(client.id, entry.id, CLIENT_ID_SIZE);
+        client.name = entry.nameString();
         clients.push_back(client);
     }
     
     return clients;
 }
 
+std::vector<ClientInfo> MessageUtils::parseClientList(const std::vector<uint8_t>& payload) {
+    return copyClients(viewClientList(payload), payload.size());
+}
+
+std::vector<ClientInfo> MessageUtils::parseClientListSince(const std::vector<uint8_t>& payload, uint32_t* cursor) {
+    if (payload.size() < 4) {
+        throw std::runtime_error("Invalid client list response");
+    }
+    
+    *cursor = readUint32(payload.data());
+    return copyClients(ClientListView(payload.data() + 4, payload.size() - 4), payload.size() - 4);
+}
+
+MessageListView MessageUtils::viewMessages(const std::vector<uint8_t>& payload) {
+    return MessageListView(payload.data(), payload.size());
+}
+
+ClientListView MessageUtils::viewClientList(const std::vector<uint8_t>& payload) {
+    return ClientListView(payload.data(), payload.size());
+}
+
 std::vector<uint8_t> MessageUtils::parsePublicKey(const std::vector<uint8_t>& payload, uint8_t* client_id) {
     if (payload.size() < CLIENT_ID_SIZE + PUBLIC_KEY_SIZE) {
         throw std::runtime_error("Invalid public key response");
@@ -39,46 +98,121 @@ std::vector<uint8_t> MessageUtils::parsePublicKey(const std::vector<uint8_t>& pa
     return public_key;
 }
 
-std::vector<Message> MessageUtils::parseMessages(const std::vector<uint8_t>& payload) {
-    std::vector<Message> messages;
+std::vector<ClientLookup> MessageUtils::parseLookupResponse(const std::vector<uint8_t>& payload) {
+    std::vector<ClientLookup> results;
+    results.reserve(payload.size() / (CLIENT_ID_SIZE + PUBLIC_KEY_SIZE));
+    
+    static const uint8_t zero_id[CLIENT_ID_SIZE] = {0};
     
-    // Parse variable-length message queue by tracking byte offset
     size_t offset = 0;
-    while (offset < payload.size()) {
-        if (offset + CLIENT_ID_SIZE + 4 + 1 + 4 > payload.size()) {
-            break;
-        }
-        
-        Message msg;
+    while (offset + CLIENT_ID_SIZE + PUBLIC_KEY_SIZE <= payload.size()) {
+        ClientLookup entry;
         
-        std::memcpy(msg.from_client, payload.data() + offset, CLIENT_ID_SIZE);
+        std::memcpy(entry.id, payload.data() + offset, CLIENT_ID_SIZE);
+        entry.found = std::memcmp(entry.id, zero_id, CLIENT_ID_SIZE) != 0;
         offset += CLIENT_ID_SIZE;
         
-        msg.id = payload[offset] | (payload[offset + 1] << 8) | 
-                 (payload[offset + 2] << 16) | (payload[offset + 3] << 24);
-        offset += 4;
-        
-        msg.type = payload[offset];
-        offset += 1;
-        
-        uint32_t content_size = payload[offset] | (payload[offset + 1] << 8) |
-                                (payload[offset + 2] << 16) | (payload[offset + 3] << 24);
-        offset += 4;
-        
-        if (offset + content_size <= payload.size()) {
-            msg.content = std::vector<uint8_t>(
+        if (entry.found) {
+            entry.public_key.assign(
                 payload.begin() + offset,
-                payload.begin() + offset + content_size
+                payload.begin() + offset + PUBLIC_KEY_SIZE
             );
-            offset += content_size;
         }
+        offset += PUBLIC_KEY_SIZE;
         
+        results.push_back(entry);
+    }
+    
+    return results;
+}
+
+static std::vector<Message> copyMessages(const MessageListView& views) {
+    std::vector<Message> messages;
+    
+    for (const auto& view : views) {
+        Message msg;
+        msg.id = view.id;
+        std::memcpy(msg.from_client, view.from_client, CLIENT_ID_SIZE);
+        msg.type = view.type;
+        msg.content.assign(view.content, view.content + view.content_size);
         messages.push_back(msg);
     }
     
     return messages;
 }
 
+std::vector<Message> MessageUtils::parseMessages(const std::vector<uint8_t>& payload) {
+    return copyMessages(viewMessages(payload));
+}
+
+std::vector<Message> MessageUtils::parseMessagePage(const std::vector<uint8_t>& payload, bool* more) {
+    if (payload.empty()) {
+        throw std::runtime_error("Invalid message page");
+    }
+    
+    *more = payload[0] != 0;
+    return copyMessages(MessageListView(payload.data() + 1, payload.size() - 1));
+}
+
+std::vector<uint32_t> MessageUtils::parseBatchResponse(const std::vector<uint8_t>& payload) {
+    if (payload.size() < 4) {
+        throw std::runtime_error("Invalid batch response");
+    }
+    
+    uint32_t count = readUint32(payload.data());
+    if (payload.size() < 4 + static_cast<size_t>(count) * (CLIENT_ID_SIZE + 4)) {
+        throw std::runtime_error("Truncated batch response");
+    }
+    
+    std::vector<uint32_t> message_ids;
+    message_ids.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        message_ids.push_back(readUint32(payload.data() + 4 + i * (CLIENT_ID_SIZE + 4) + CLIENT_ID_SIZE));
+    }
+    
+    return message_ids;
+}
+
+FileDescriptor MessageUtils::parseFileDescriptor(const std::vector<uint8_t>& content) {
+    if (content.size() < 12) {
+        throw std::runtime_error("Invalid file descriptor");
+    }
+    
+    FileDescriptor descriptor;
+    descriptor.chunk_count = readUint32(content.data());
+    descriptor.total_size = static_cast<uint64_t>(readUint32(content.data() + 4)) |
+                            (static_cast<uint64_t>(readUint32(content.data() + 8)) << 32);
+    return descriptor;
+}
+
+bool MessageUtils::isChunkedFile(uint8_t msg_type) {
+    return msg_type == MSG_TYPE_FILE_CHUNKED || msg_type == MSG_TYPE_FILE_CHUNKED_IV ||
+           msg_type == MSG_TYPE_FILE_CHUNKED_COMPRESSED;
+}
+
+std::vector<uint8_t> MessageUtils::parseFileChunk(const std::vector<uint8_t>& payload, uint32_t expected_message_id,
+                                                  uint32_t expected_index, uint8_t msg_type) {
+    if (payload.size() < 12) {
+        throw std::runtime_error("Invalid file chunk response");
+    }
+    
+    uint32_t message_id = readUint32(payload.data());
+    uint32_t chunk_index = readUint32(payload.data() + 4);
+    uint32_t content_size = readUint32(payload.data() + 8);
+    if (message_id != expected_message_id || chunk_index != expected_index ||
+        payload.size() < 12 + static_cast<size_t>(content_size)) {
+        throw std::runtime_error("Unexpected file chunk in response");
+    }
+    
+    size_t zero_iv = 0;
+    if (msg_type == MSG_TYPE_FILE_CHUNKED) {
+        zero_iv = AESWrapper::IV_SIZE;
+    }
+    std::vector<uint8_t> chunk(zero_iv + content_size);
+    std::memcpy(chunk.data() + zero_iv, payload.data() + 12, content_size);
+    return chunk;
+}
+
 std::string MessageUtils::bytesToHex(const uint8_t* bytes, size_t length) {
     std::ostringstream oss;
     oss << std::hex << std::setfill('0');
@@ -0,0 +1,79 @@
+#include "pipeline.h"
+#include "connection.h"
+#include "instrument.h"
+
+#include <stdexcept>
+
+constexpr size_t RequestPipeline::DEFAULT_WINDOW;
+
+RequestPipeline::RequestPipeline(Connection& connection, size_t window)
+    : connection(connection), window(window > 0 ? window : 1), error_count(0) {}
+
+RequestPipeline::~RequestPipeline() {
+    if (!pending.empty()) {
+        connection.close();
+    }
+}
+
+void RequestPipeline::submit(const uint8_t* prefix, size_t prefix_size,
+                             const std::vector<uint8_t>& content, Handler handler) {
+    while (pending.size() >= window) {
+        receiveOne();
+    }
+
+    // Unlike a lone request, a failed write can't be retried on a new socket:
+    // requests already in flight would be lost with the old one
+    if (!connection.sendGather(prefix, prefix_size, content.data(), content.size())) {
+        fail("Failed to send pipelined request");
+    }
+    pending.push_back(std::move(handler));
+}
+
+void RequestPipeline::submit(const std::vector<uint8_t>& request, Handler handler) {
+    submit(request.data(), request.size(), std::vector<uint8_t>(), std::move(handler));
+}
+
+void RequestPipeline::drain() {
+    while (!pending.empty()) {
+        receiveOne();
+    }
+}
+
+void RequestPipeline::receiveOne() {
+    std::vector<uint8_t> header(7);
+    {
+        // With a full window this includes the server's work on earlier requests
+        INSTRUMENT_TIMER(timer, instrument::PHASE_SERVER_WAIT);
+        if (!connection.recvAll(header.data(), header.size())) {
+            fail("Failed to receive pipelined response header");
+        }
+    }
+
+    ResponseHeader resp_header = Protocol::unpackResponseHeader(header);
+
+    // Reused across responses; handlers may swap it out to keep the bytes
+    payload.resize(resp_header.payload_size);
+    if (!payload.empty()) {
+        INSTRUMENT_TIMER(timer, instrument::PHASE_RECEIVE);
+        INSTRUMENT_ADD_BYTES(timer, payload.size());
+        if (!connection.recvAll(payload.data(), payload.size())) {
+            fail("Failed to receive pipelined response payload");
+        }
+    }
+
+    if (resp_header.code == RES_GENERAL_ERROR) {
+        error_count++;
+    }
+
+    Handler handler = std::move(pending.front());
+    pending.pop_front();
+    if (handler) {
+        handler(resp_header, payload);
+    }
+}
+
+void RequestPipeline::fail(const char* what) {
+    pending.clear();
+    connection.close();
+    throw std::runtime_error(what);
+}
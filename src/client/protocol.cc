@@ -1,30 +1,60 @@
 #include "protocol.h"
+#include <algorithm>
 #include <cstring>
 #include <stdexcept>
 
-std::vector<uint8_t> Protocol::packRequestHeader(
+void Protocol::writeRequestHeader(
+    uint8_t* out,
     const uint8_t* client_id,
     uint16_t code,
     uint32_t payload_size
 ) {
-    std::vector<uint8_t> header(HEADER_SIZE);
-    
-    std::memcpy(header.data(), client_id, CLIENT_ID_SIZE);
+    std::memcpy(out, client_id, CLIENT_ID_SIZE);
     
-    header[CLIENT_ID_SIZE] = VERSION;
+    out[CLIENT_ID_SIZE] = VERSION;
     
     // Little-endian encoding for cross-platform compatibility
-    header[CLIENT_ID_SIZE + 1] = code & 0xFF;
-    header[CLIENT_ID_SIZE + 2] = (code >> 8) & 0xFF;
-    
-    header[CLIENT_ID_SIZE + 3] = payload_size & 0xFF;
-    header[CLIENT_ID_SIZE + 4] = (payload_size >> 8) & 0xFF;
-    header[CLIENT_ID_SIZE + 5] = (payload_size >> 16) & 0xFF;
-    header[CLIENT_ID_SIZE + 6] = (payload_size >> 24) & 0xFF;
+    out[CLIENT_ID_SIZE + 1] = code & 0xFF;
+    out[CLIENT_ID_SIZE + 2] = (code >> 8) & 0xFF;
     
+    out[CLIENT_ID_SIZE + 3] = payload_size & 0xFF;
+    out[CLIENT_ID_SIZE + 4] = (payload_size >> 8) & 0xFF;
+    out[CLIENT_ID_SIZE + 5] = (payload_size >> 16) & 0xFF;
+    out[CLIENT_ID_SIZE + 6] = (payload_size >> 24) & 0xFF;
+}
+
+std::vector<uint8_t> Protocol::packRequestHeader(
+    const uint8_t* client_id,
+    uint16_t code,
+    uint32_t payload_size
+) {
+    std::vector<uint8_t> header(HEADER_SIZE);
+    writeRequestHeader(header.data(), client_id, code, payload_size);
     return header;
 }
 
+static void writeUint32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+static void appendUint32(std::vector<uint8_t>& request, uint32_t value) {
+    request.push_back(value & 0xFF);
+    request.push_back((value >> 8) & 0xFF);
+    request.push_back((value >> 16) & 0xFF);
+    request.push_back((value >> 24) & 0xFF);
+}
+
+// Fixed-size username field (null-terminated, padded with zeros)
+static void appendUsername(std::vector<uint8_t>& request, const std::string& username) {
+    size_t offset = request.size();
+    request.resize(offset + USERNAME_MAX_SIZE, 0);
+    size_t len = std::min(username.length(), size_t(USERNAME_MAX_SIZE - 1));
+    std::memcpy(request.data() + offset, username.c_str(), len);
+}
+
 ResponseHeader Protocol::unpackResponseHeader(const std::vector<uint8_t>& data) {
     if (data.size() < 7) {
         throw std::runtime_error("Invalid response header size");
@@ -47,11 +77,7 @@ std::vector<uint8_t> Protocol::packRegisterRequest(
     
     auto request = packRequestHeader(empty_id, REQ_REGISTER, payload_size);
     
-    // Fixed-size username field (null-terminated, padded with zeros)
-    std::vector<uint8_t> username_bytes(USERNAME_MAX_SIZE, 0);
-    size_t len = std::min(username.length(), size_t(USERNAME_MAX_SIZE - 1));
-    std::memcpy(username_bytes.data(), username.c_str(), len);
-    request.insert(request.end(), username_bytes.begin(), username_bytes.end());
+    appendUsername(request, username);
     
     if (public_key.size() != PUBLIC_KEY_SIZE) {
         throw std::runtime_error("Invalid public key size");
@@ -65,6 +91,32 @@ std::vector<uint8_t> Protocol::packClientListRequest(const uint8_t* client_id) {
     return packRequestHeader(client_id, REQ_CLIENT_LIST, 0);
 }
 
+std::vector<uint8_t> Protocol::packClientListSinceRequest(
+    const uint8_t* client_id,
+    uint32_t cursor
+) {
+    auto request = packRequestHeader(client_id, REQ_CLIENT_LIST_SINCE, 4);
+    
+    appendUint32(request, cursor);
+    
+    return request;
+}
+
+std::vector<uint8_t> Protocol::packLookupRequest(
+    const uint8_t* client_id,
+    const std::vector<std::string>& names
+) {
+    uint32_t payload_size = names.size() * USERNAME_MAX_SIZE;
+    auto request = packRequestHeader(client_id, REQ_LOOKUP_CLIENTS, payload_size);
+    request.reserve(HEADER_SIZE + payload_size);
+    
+    for (const auto& name : names) {
+        appendUsername(request, name);
+    }
+    
+    return request;
+}
+
 std::vector<uint8_t> Protocol::packPublicKeyRequest(
     const uint8_t* client_id,
     const uint8_t* target_client_id
@@ -82,29 +134,154 @@ std::vector<uint8_t> Protocol::packWaitingMessagesRequest(const uint8_t* client_
     return packRequestHeader(client_id, REQ_WAITING_MESSAGES, 0);
 }
 
+std::vector<uint8_t> Protocol::packMessagePageRequest(
+    const uint8_t* client_id,
+    uint32_t after_id,
+    uint32_t max_messages,
+    uint32_t max_bytes
+) {
+    auto request = packRequestHeader(client_id, REQ_MESSAGE_PAGE, 12);
+    appendUint32(request, after_id);
+    appendUint32(request, max_messages);
+    appendUint32(request, max_bytes);
+    return request;
+}
+
+std::vector<uint8_t> Protocol::packWaitMessagesRequest(
+    const uint8_t* client_id,
+    uint32_t after_id,
+    uint32_t timeout_ms,
+    uint32_t max_messages,
+    uint32_t max_bytes
+) {
+    auto request = packRequestHeader(client_id, REQ_WAIT_MESSAGES, 16);
+    appendUint32(request, after_id);
+    appendUint32(request, timeout_ms);
+    appendUint32(request, max_messages);
+    appendUint32(request, max_bytes);
+    return request;
+}
+
+std::vector<uint8_t> Protocol::packAckMessagesRequest(
+    const uint8_t* client_id,
+    uint32_t through_id
+) {
+    auto request = packRequestHeader(client_id, REQ_ACK_MESSAGES, 4);
+    appendUint32(request, through_id);
+    return request;
+}
+
+std::vector<uint8_t> Protocol::packBatchSendRequest(
+    const uint8_t* from_client_id,
+    const std::vector<OutgoingMessage>& messages,
+    size_t begin,
+    size_t end
+) {
+    uint32_t payload_size = 4;
+    for (size_t i = begin; i < end; i++) {
+        payload_size += CLIENT_ID_SIZE + 1 + 4 + messages[i].content.size();
+    }
+    
+    auto request = packRequestHeader(from_client_id, REQ_SEND_BATCH, payload_size);
+    request.reserve(HEADER_SIZE + payload_size);
+    
+    appendUint32(request, end - begin);
+    for (size_t i = begin; i < end; i++) {
+        const OutgoingMessage& msg = messages[i];
+        request.insert(request.end(), msg.to_client, msg.to_client + CLIENT_ID_SIZE);
+        request.push_back(msg.type);
+        appendUint32(request, msg.content.size());
+        request.insert(request.end(), msg.content.begin(), msg.content.end());
+    }
+    
+    return request;
+}
+
+void Protocol::packSendMessagePrefix(
+    uint8_t* out,
+    const uint8_t* from_client_id,
+    const uint8_t* to_client_id,
+    uint8_t msg_type,
+    uint32_t content_size
+) {
+    uint32_t payload_size = CLIENT_ID_SIZE + 1 + 4 + content_size;
+    writeRequestHeader(out, from_client_id, REQ_SEND_MESSAGE, payload_size);
+    out += HEADER_SIZE;
+    
+    std::memcpy(out, to_client_id, CLIENT_ID_SIZE);
+    out += CLIENT_ID_SIZE;
+    
+    *out++ = msg_type;
+    writeUint32(out, content_size);
+}
+
 std::vector<uint8_t> Protocol::packSendMessageRequest(
     const uint8_t* from_client_id,
     const uint8_t* to_client_id,
     uint8_t msg_type,
     const std::vector<uint8_t>& content
 ) {
-    uint32_t payload_size = CLIENT_ID_SIZE + 1 + 4 + content.size();
-    auto request = packRequestHeader(from_client_id, REQ_SEND_MESSAGE, payload_size);
-    
-    for (size_t i = 0; i < CLIENT_ID_SIZE; i++) {
-        request.push_back(to_client_id[i]);
+    std::vector<uint8_t> request(SEND_MESSAGE_PREFIX_SIZE + content.size());
+    packSendMessagePrefix(request.data(), from_client_id, to_client_id, msg_type, content.size());
+    if (!content.empty()) {
+        std::memcpy(request.data() + SEND_MESSAGE_PREFIX_SIZE, content.data(), content.size());
     }
     
-    request.push_back(msg_type);
+    return request;
+}
+
+void Protocol::packFileChunkPrefix(
+    uint8_t* out,
+    const uint8_t* from_client_id,
+    const uint8_t* to_client_id,
+    uint32_t transfer_id,
+    uint32_t chunk_index,
+    bool is_last,
+    bool compressed,
+    uint32_t content_size
+) {
+    uint32_t payload_size = CLIENT_ID_SIZE + 4 + 4 + 1 + 4 + content_size;
+    writeRequestHeader(out, from_client_id, compressed ? REQ_SEND_FILE_CHUNK_COMPRESSED : REQ_SEND_FILE_CHUNK_IV,
+                       payload_size);
+    out += HEADER_SIZE;
     
-    uint32_t content_size = content.size();
-    request.push_back(content_size & 0xFF);
-    request.push_back((content_size >> 8) & 0xFF);
-    request.push_back((content_size >> 16) & 0xFF);
-    request.push_back((content_size >> 24) & 0xFF);
+    std::memcpy(out, to_client_id, CLIENT_ID_SIZE);
+    out += CLIENT_ID_SIZE;
     
-    request.insert(request.end(), content.begin(), content.end());
+    writeUint32(out, transfer_id);
+    writeUint32(out + 4, chunk_index);
+    out[8] = is_last ? 1 : 0;
+    writeUint32(out + 9, content_size);
+}
+
+std::vector<uint8_t> Protocol::packFileChunkRequest(
+    const uint8_t* from_client_id,
+    const uint8_t* to_client_id,
+    uint32_t transfer_id,
+    uint32_t chunk_index,
+    bool is_last,
+    bool compressed,
+    const std::vector<uint8_t>& content
+) {
+    std::vector<uint8_t> request(FILE_CHUNK_PREFIX_SIZE + content.size());
+    packFileChunkPrefix(request.data(), from_client_id, to_client_id,
+                        transfer_id, chunk_index, is_last, compressed, content.size());
+    if (!content.empty()) {
+        std::memcpy(request.data() + FILE_CHUNK_PREFIX_SIZE, content.data(), content.size());
+    }
     
     return request;
 }
 
+std::vector<uint8_t> Protocol::packFetchFileChunkRequest(
+    const uint8_t* client_id,
+    uint32_t message_id,
+    uint32_t chunk_index
+) {
+    auto request = packRequestHeader(client_id, REQ_FETCH_FILE_CHUNK, 8);
+    
+    appendUint32(request, message_id);
+    appendUint32(request, chunk_index);
+    
+    return request;
+}
@@ -0,0 +1,622 @@
+#include "script.h"
+#include "client.h"
+#include "protocol.h"
+#include "message.h"
+#include "mailbox.h"
+#include "instrument.h"
+#include "compression.h"
+#include "crypto/RSAPrivateWrapper.h"
+#include "crypto/RSAPublicWrapper.h"
+#include "crypto/AESWrapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+struct ScriptRunner::Upload {
+    size_t line;
+    ConnectionPool::Lease lease;
+    uint8_t target_id[CLIENT_ID_SIZE];
+    std::vector<uint8_t> key;
+    std::ifstream file;
+    uint64_t file_size;
+    // Set by the upload thread once result is final
+    std::atomic<bool> done;
+    bool failed;
+    // OK fields, or the ERR reason
+    std::string result;
+    std::thread thread;
+};
+
+struct ScriptRunner::Download {
+    Message msg;
+    std::vector<uint8_t> key;
+    std::string filename;
+    bool saved;
+    uint64_t written;
+    // Empty unless fetching or decrypting threw
+    std::string error;
+};
+
+// Splits "word rest of line" at the first space
+static void splitFirst(const std::string& text, std::string& first, std::string& rest) {
+    size_t space = text.find(' ');
+    if (space == std::string::npos) {
+        first = text;
+        rest.clear();
+        return;
+    }
+    first = text.substr(0, space);
+    size_t start = text.find_first_not_of(' ', space);
+    rest = start == std::string::npos ? std::string() : text.substr(start);
+}
+
+ScriptRunner::ScriptRunner(MessageUClient& client, std::ostream& out)
+    : client(client), out(out), failures(0) {}
+
+ScriptRunner::~ScriptRunner() {
+    for (auto& upload : uploads) {
+        if (upload->thread.joinable()) {
+            upload->thread.join();
+        }
+    }
+}
+
+std::string ScriptRunner::escape(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '\\': escaped += "\\\\"; break;
+            case '\t': escaped += "\\t"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\n': escaped += "\\n"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+size_t ScriptRunner::run(std::istream& in) {
+    std::string text;
+    size_t line = 0;
+
+    while (std::getline(in, text)) {
+        line++;
+
+        if (!text.empty() && text.back() == '\r') {
+            text.pop_back();
+        }
+        size_t start = text.find_first_not_of(" \t");
+        if (start == std::string::npos || text[start] == '#') {
+            continue;
+        }
+
+        std::string command, args;
+        splitFirst(text.substr(start), command, args);
+
+        // Queued commands keep collecting; anything else sees their results first
+        bool queued = command == "send" || command == "sendfile" ||
+                      command == "keyreq" || command == "keysend";
+        if (!queued) {
+            flush();
+        }
+
+        try {
+            execute(line, command, args);
+        } catch (const std::exception& e) {
+            // The reply to whatever failed may still be on the wire
+            client.disconnect();
+            error(line, command, e.what());
+        }
+
+        if (pending.size() >= MAX_BATCH_MESSAGES) {
+            flush();
+        }
+        collectUploads(false);
+        out.flush();
+    }
+
+    flush();
+    collectUploads(true);
+    client.releaseConnection();
+    out.flush();
+    return failures;
+}
+
+void ScriptRunner::execute(size_t line, const std::string& command, const std::string& args) {
+    std::string name, rest;
+    splitFirst(args, name, rest);
+
+    if (command == "register") {
+        // Uploads in flight were sent as the current identity
+        collectUploads(true);
+        if (name.empty()) {
+            error(line, command, "usage: register <name>");
+            return;
+        }
+        registerClient(line, name);
+        return;
+    }
+
+    if (command == "stats") {
+        ConnectionStats total{0, 0, 0};
+        std::string per_connection;
+        for (const auto& stats : client.connectionStats()) {
+            total.opened += stats.opened;
+            total.reused += stats.reused;
+            total.failed_attempts += stats.failed_attempts;
+            per_connection += "\t" + std::to_string(stats.opened) + "/" + std::to_string(stats.reused) +
+                              "/" + std::to_string(stats.failed_attempts);
+        }
+        ok(line, command, std::to_string(total.opened) + "\t" + std::to_string(total.reused) +
+                          "\t" + std::to_string(total.failed_attempts) + per_connection);
+        return;
+    }
+
+    if (command == "timings") {
+        std::ostringstream json;
+        instrument::dump(json);
+        std::string text = json.str();
+        if (!text.empty() && text.back() == '\n') {
+            text.pop_back();
+        }
+        ok(line, command, text);
+        return;
+    }
+
+    if (command == "flush") {
+        collectUploads(true);
+        ok(line, command);
+        return;
+    }
+
+    bool known = command == "list" || command == "fetch" || command == "pubkey" ||
+                 command == "keyreq" || command == "keysend" || command == "send" ||
+                 command == "sendfile";
+    if (!known) {
+        error(line, command, "unknown command");
+        return;
+    }
+
+    if (!client.registered) {
+        error(line, command, "not registered");
+        return;
+    }
+
+    if (!client.connect()) {
+        error(line, command, "could not connect to server");
+        return;
+    }
+
+    if (command == "list") {
+        listClients(line);
+    } else if (command == "fetch") {
+        fetch(line);
+    } else if (name.empty()) {
+        error(line, command, "missing client name");
+    } else if (command == "pubkey") {
+        publicKey(line, name);
+    } else if (command == "keyreq") {
+        requestKey(line, name);
+    } else if (command == "keysend") {
+        sendKey(line, name);
+    } else if (command == "send") {
+        sendText(line, name, rest);
+    } else {
+        sendFile(line, name, rest);
+    }
+}
+
+void ScriptRunner::flush() {
+    if (pending.empty()) {
+        return;
+    }
+
+    std::string failure;
+    auto message_ids = client.flushOutbox(failure);
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        uint32_t message_id = message_ids[i];
+        if (message_id != 0) {
+            if (!pending[i].key.empty()) {
+                client.saveSymmetricKey(pending[i].target_id.data(), pending[i].key);
+            }
+            ok(pending[i].line, pending[i].command, std::to_string(message_id));
+        } else if (!failure.empty()) {
+            error(pending[i].line, pending[i].command, failure);
+        } else {
+            error(pending[i].line, pending[i].command, "rejected by server");
+        }
+    }
+    pending.clear();
+}
+
+void ScriptRunner::collectUploads(bool wait) {
+    for (auto it = uploads.begin(); it != uploads.end(); ) {
+        Upload& upload = **it;
+        if (!wait && !upload.done) {
+            ++it;
+            continue;
+        }
+
+        if (upload.thread.joinable()) {
+            upload.thread.join();
+        }
+        if (upload.failed) {
+            error(upload.line, "sendfile", upload.result);
+        } else {
+            ok(upload.line, "sendfile", upload.result);
+        }
+        it = uploads.erase(it);
+    }
+}
+
+void ScriptRunner::runUpload(Upload& upload) {
+    Connection& conn = upload.lease ? *upload.lease : client.connection;
+    try {
+        if (!conn.acquire()) {
+            throw std::runtime_error("could not connect to server");
+        }
+        uint64_t encrypted_size = client.sendFileChunks(conn, upload.target_id, upload.file,
+                                                        upload.file_size, upload.key);
+        upload.failed = false;
+        upload.result = "chunked\t" + std::to_string(encrypted_size);
+    } catch (const std::exception& e) {
+        upload.failed = true;
+        upload.result = e.what();
+    }
+
+    // Free for the next upload or download before the result is collected
+    if (upload.lease && !client.persistent) {
+        upload.lease->close();
+    }
+    upload.lease.release();
+    upload.done = true;
+}
+
+void ScriptRunner::registerClient(size_t line, const std::string& name) {
+    if (client.registerAs(name)) {
+        ok(line, "register", MessageUtils::bytesToHex(client.client_id, CLIENT_ID_SIZE));
+    } else {
+        error(line, "register", "no client ID in response");
+    }
+}
+
+void ScriptRunner::listClients(size_t line) {
+    client.refreshDirectory();
+
+    const auto& clients = client.directory.getClients();
+    for (const auto& info : clients) {
+        out << line << "\tCLIENT\t" << MessageUtils::bytesToHex(info.id, CLIENT_ID_SIZE)
+            << "\t" << escape(info.name) << "\n";
+    }
+    ok(line, "list", std::to_string(clients.size()));
+}
+
+void ScriptRunner::publicKey(size_t line, const std::string& name) {
+    uint8_t target_id[CLIENT_ID_SIZE];
+    if (!client.resolveClient(name, target_id)) {
+        error(line, "pubkey", "client not found");
+        return;
+    }
+
+    const auto& public_key = client.fetchPublicKey(target_id);
+    ok(line, "pubkey", MessageUtils::bytesToHex(public_key.data(), public_key.size()));
+}
+
+void ScriptRunner::requestKey(size_t line, const std::string& name) {
+    uint8_t target_id[CLIENT_ID_SIZE];
+    if (!client.resolveClient(name, target_id)) {
+        error(line, "keyreq", "client not found");
+        return;
+    }
+
+    queue(line, "keyreq", target_id, MSG_TYPE_SYM_KEY_REQUEST, std::vector<uint8_t>());
+}
+
+void ScriptRunner::sendKey(size_t line, const std::string& name) {
+    uint8_t target_id[CLIENT_ID_SIZE];
+    if (!client.resolveClient(name, target_id)) {
+        error(line, "keysend", "client not found");
+        return;
+    }
+
+    client.fetchPublicKey(target_id);
+
+    AESWrapper aes;
+    auto symmetric_key = aes.getKey();
+    auto rsa_public = client.public_key_cache.getWrapper(target_id);
+    auto encrypted_key = rsa_public->encrypt(symmetric_key);
+
+    queue(line, "keysend", target_id, MSG_TYPE_SYM_KEY_SEND, encrypted_key);
+    pending.back().key = symmetric_key;
+    pending.back().target_id.assign(target_id, target_id + CLIENT_ID_SIZE);
+    // Commands after this one encrypt with the new key, so it has to be
+    // accepted (and kept) before they run
+    flush();
+}
+
+void ScriptRunner::sendText(size_t line, const std::string& name, const std::string& text) {
+    uint8_t target_id[CLIENT_ID_SIZE];
+    if (!resolveWithKey(line, "send", name, target_id)) {
+        return;
+    }
+
+    AESWrapper& aes = client.symmetricCipher(target_id);
+    uint8_t type = MSG_TYPE_TEXT_MESSAGE;
+    auto encrypted = compression::encryptContent(aes, type, reinterpret_cast<const uint8_t*>(text.data()),
+                                                 text.size());
+    queue(line, "send", target_id, type, encrypted);
+}
+
+void ScriptRunner::sendFile(size_t line, const std::string& name, const std::string& path) {
+    uint8_t target_id[CLIENT_ID_SIZE];
+    if (!resolveWithKey(line, "sendfile", name, target_id)) {
+        return;
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        error(line, "sendfile", "file not found");
+        return;
+    }
+
+    uint64_t file_size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    if (file_size > FILE_CHUNK_SIZE) {
+        // On a connection of its own, so the commands after it don't wait for
+        // the whole file; checkout() blocks only while every pooled connection
+        // is busy
+        std::unique_ptr<Upload> upload(new Upload());
+        upload->line = line;
+        std::memcpy(upload->target_id, target_id, CLIENT_ID_SIZE);
+        upload->key = client.getSymmetricKey(target_id);
+        upload->file = std::move(file);
+        upload->file_size = file_size;
+        upload->done = false;
+        upload->failed = false;
+        // Created here, since the upload thread can't do it safely
+        client.cryptoPool();
+
+        Upload* started = upload.get();
+        uploads.push_back(std::move(upload));
+        if (client.connections.maxConnections() < 2) {
+            // No connection to spare: it runs on the session, after the
+            // queued messages since chunk acks come back one by one
+            flush();
+            runUpload(*started);
+            return;
+        }
+        started->lease = client.connections.checkout();
+        started->thread = std::thread(&ScriptRunner::runUpload, this, std::ref(*started));
+        return;
+    }
+
+    AESWrapper& aes = client.symmetricCipher(target_id);
+
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+    uint8_t type = MSG_TYPE_FILE;
+    auto encrypted = compression::encryptContent(aes, type, contents.data(), contents.size());
+    queue(line, "sendfile", target_id, type, encrypted);
+}
+
+void ScriptRunner::fetch(size_t line) {
+    size_t count = 0;
+    uint32_t acked = 0;
+    // Below the first chunked file that failed to download; acknowledging it
+    // would delete its chunks, so it and what follows are fetched again next time
+    uint32_t ack_limit = UINT32_MAX;
+    client.readMailbox(0, acked,
+        [&](MailboxReader& mailbox, std::vector<Message>& held) {
+            count += client.readPage(mailbox, held, [&](const Message& msg, MailboxReader& reader) {
+                reportMessage(line, msg, &reader);
+            });
+        },
+        [&](const std::vector<Message>& held, uint32_t last_id) {
+            // Messages from new senders first: a key among them is needed
+            // for the chunked files after it
+            for (const auto& msg : held) {
+                if (!MessageUtils::isChunkedFile(msg.type)) {
+                    reportMessage(line, msg, nullptr);
+                }
+            }
+
+            std::vector<Download> downloads;
+            for (const auto& file_msg : held) {
+                if (MessageUtils::isChunkedFile(file_msg.type) && client.hasSymmetricKey(file_msg.from_client)) {
+                    Download download;
+                    download.msg = file_msg;
+                    download.key = client.getSymmetricKey(file_msg.from_client);
+                    download.filename = MessageUClient::receivedFilePath(file_msg.id);
+                    download.saved = false;
+                    download.written = 0;
+                    downloads.push_back(std::move(download));
+                }
+            }
+            downloadChunkedFiles(downloads);
+            for (const auto& download : downloads) {
+                if (!download.saved || !download.error.empty()) {
+                    ack_limit = std::min(ack_limit, download.msg.id - 1);
+                }
+            }
+
+            size_t next_download = 0;
+            for (const auto& file_msg : held) {
+                if (!MessageUtils::isChunkedFile(file_msg.type)) {
+                    continue;
+                }
+                const Download* download = nullptr;
+                if (next_download < downloads.size() && downloads[next_download].msg.id == file_msg.id) {
+                    download = &downloads[next_download++];
+                }
+                reportMessage(line, file_msg, nullptr, download);
+            }
+
+            // Reported, so the server can drop them
+            return std::min(last_id, ack_limit);
+        });
+
+    ok(line, "fetch", std::to_string(count));
+}
+
+void ScriptRunner::downloadChunkedFiles(std::vector<Download>& downloads) {
+    if (downloads.empty()) {
+        return;
+    }
+    client.cryptoPool();
+
+    std::atomic<size_t> next(0);
+    auto work = [&](Connection& conn) {
+        for (size_t i = next++; i < downloads.size(); i = next++) {
+            Download& download = downloads[i];
+            try {
+                if (!conn.acquire()) {
+                    throw std::runtime_error("could not connect to server");
+                }
+                download.saved = client.receiveFileChunks(conn, download.msg, download.key,
+                                                          download.filename, &download.written);
+            } catch (const std::exception& e) {
+                download.error = e.what();
+            }
+        }
+    };
+
+    // The session takes a share itself; connections busy with uploads are
+    // left alone rather than waited for
+    std::vector<ConnectionPool::Lease> leases;
+    while (leases.size() + 1 < downloads.size()) {
+        ConnectionPool::Lease lease = client.connections.tryCheckout();
+        if (!lease) {
+            break;
+        }
+        leases.push_back(std::move(lease));
+    }
+
+    std::vector<std::thread> workers;
+    for (auto& lease : leases) {
+        workers.emplace_back([&work, &lease, this]() {
+            work(*lease);
+            if (!client.persistent) {
+                lease->close();
+            }
+        });
+    }
+    work(client.connection);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ScriptRunner::reportMessage(size_t line, const Message& msg, MailboxReader* mailbox,
+                                 const Download* download) {
+    std::string type;
+    std::string detail;
+
+    if (MessageUtils::isChunkedFile(msg.type)) {
+        type = "file";
+        if (!download) {
+            detail = "undecryptable: no symmetric key";
+        } else if (!download->error.empty()) {
+            std::remove(download->filename.c_str());
+            detail = "undecryptable: " + download->error;
+        } else if (download->saved) {
+            detail = escape(download->filename) + "\t" + std::to_string(download->written);
+        } else {
+            detail = "could not save file";
+        }
+    } else {
+        // Decrypted and saved as the menu does; only the output differs
+        auto received = client.decodeMessage(msg, mailbox);
+        switch (msg.type) {
+            case MSG_TYPE_SYM_KEY_REQUEST:
+                type = "keyreq";
+                break;
+            case MSG_TYPE_SYM_KEY_SEND:
+                type = "key";
+                detail = received.error.empty() ? "saved" : "undecryptable: " + received.error;
+                break;
+            case MSG_TYPE_TEXT_MESSAGE:
+            case MSG_TYPE_TEXT_COMPRESSED:
+                type = "text";
+                if (received.no_key) {
+                    detail = "undecryptable: no symmetric key";
+                } else if (!received.error.empty()) {
+                    detail = "undecryptable: " + received.error;
+                } else {
+                    detail = escape(std::string(received.plaintext.begin(), received.plaintext.end()));
+                }
+                break;
+            case MSG_TYPE_FILE:
+            case MSG_TYPE_FILE_COMPRESSED:
+                type = "file";
+                if (received.no_key) {
+                    // Unread mailbox content is skipped by the next read
+                    detail = "undecryptable: no symmetric key";
+                } else if (!received.error.empty()) {
+                    detail = "undecryptable: " + received.error;
+                } else if (received.saved) {
+                    detail = escape(received.filename) + "\t" + std::to_string(received.written);
+                } else {
+                    detail = "could not save file";
+                }
+                break;
+            default:
+                type = "unknown";
+                detail = std::to_string(msg.content.size());
+                break;
+        }
+    }
+
+    out << line << "\tMSG\t" << msg.id << "\t" << escape(client.senderName(msg.from_client))
+        << "\t" << type;
+    if (!detail.empty()) {
+        out << "\t" << detail;
+    }
+    out << "\n";
+}
+
+bool ScriptRunner::resolveWithKey(size_t line, const std::string& command, const std::string& name,
+                                  uint8_t* target_id) {
+    if (!client.resolveClient(name, target_id)) {
+        error(line, command, "client not found");
+        return false;
+    }
+    if (!client.hasSymmetricKey(target_id)) {
+        error(line, command, "no symmetric key");
+        return false;
+    }
+    return true;
+}
+
+void ScriptRunner::queue(size_t line, const std::string& command, const uint8_t* target_id,
+                         uint8_t msg_type, const std::vector<uint8_t>& content) {
+    client.queueMessage(target_id, msg_type, content);
+    Pending entry;
+    entry.line = line;
+    entry.command = command;
+    pending.push_back(std::move(entry));
+}
+
+void ScriptRunner::ok(size_t line, const std::string& command, const std::string& fields) {
+    out << line << "\tOK\t" << command;
+    if (!fields.empty()) {
+        out << "\t" << fields;
+    }
+    out << "\n";
+}
+
+void ScriptRunner::error(size_t line, const std::string& command, const std::string& reason) {
+    failures++;
+    out << line << "\tERR\t" << command << "\t" << escape(reason) << "\n";
+}
@@ -1,25 +1,34 @@
 import sqlite3
+import threading
 import uuid
 from datetime import datetime
 import logging
+from protocol import pack_file_descriptor
+from notifier import MailboxNotifier
 
 logger = logging.getLogger(__name__)
 
 class Database:
     def __init__(self, db_name='defensive.db'):
         self.db_name = db_name
-        self.conn = None
+        # Each client thread gets its own connection; a client may now hold
+        # several sockets at once, so handlers do run concurrently
+        self.local = threading.local()
+        # Wakes REQ_WAIT_MESSAGES requests when a message for their client is stored
+        self.arrivals = MailboxNotifier()
         self.init_database()
     
     def connect(self):
-        self.conn = sqlite3.connect(self.db_name)
-        self.conn.row_factory = sqlite3.Row
-        return self.conn
+        conn = sqlite3.connect(self.db_name)
+        conn.row_factory = sqlite3.Row
+        self.local.conn = conn
+        return conn
     
     def close(self):
-        if self.conn:
-            self.conn.close()
-            self.conn = None
+        conn = getattr(self.local, 'conn', None)
+        if conn:
+            conn.close()
+            self.local.conn = None
     
     def init_database(self):
         conn = self.connect()
@@ -44,6 +53,30 @@ class Database:
             )
         ''')
         
+        # Chunks of large file transfers; MessageID is set once the last chunk
+        # arrives and the transfer is published as a MSG_TYPE_FILE_CHUNKED,
+        # MSG_TYPE_FILE_CHUNKED_IV or MSG_TYPE_FILE_CHUNKED_COMPRESSED message
+        cursor.execute('''
+            CREATE TABLE IF NOT EXISTS file_chunks (
+                FromClient BLOB NOT NULL,
+                ToClient BLOB NOT NULL,
+                TransferID INTEGER NOT NULL,
+                ChunkIndex INTEGER NOT NULL,
+                MessageID INTEGER,
+                Content BLOB,
+                PRIMARY KEY (FromClient, TransferID, ChunkIndex)
+            )
+        ''')
+        # Paged mailbox reads walk one recipient's messages in ID order
+        cursor.execute('''
+            CREATE INDEX IF NOT EXISTS messages_by_recipient
+            ON messages (ToClient, ID)
+        ''')
+        cursor.execute('''
+            CREATE INDEX IF NOT EXISTS file_chunks_by_message
+            ON file_chunks (MessageID, ChunkIndex)
+        ''')
+        
         conn.commit()
         
         cursor.execute('SELECT COUNT(*) FROM clients')
@@ -94,6 +127,25 @@ class Database:
         finally:
             self.close()
     
+    def get_clients_since(self, cursor):
+        """Clients registered after cursor (a clients rowid), plus the new cursor."""
+        try:
+            conn = self.connect()
+            cursor_obj = conn.cursor()
+            
+            cursor_obj.execute('''
+                SELECT rowid, ID, Name FROM clients
+                WHERE rowid > ?
+                ORDER BY rowid
+            ''', (cursor,))
+            rows = cursor_obj.fetchall()
+            
+            new_cursor = rows[-1]['rowid'] if rows else cursor
+            return new_cursor, [(row['ID'], row['Name']) for row in rows]
+            
+        finally:
+            self.close()
+    
     def get_client_public_key(self, client_id):
         try:
             conn = self.connect()
@@ -128,6 +180,30 @@ class Database:
         finally:
             self.close()
     
+    def get_clients_by_names(self, names):
+        """Maps each known name to (id, public_key) using a single connection."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            found = {}
+            unique_names = list(set(names))
+            # Stay well under SQLite's bound-parameter limit
+            for start in range(0, len(unique_names), 500):
+                batch = unique_names[start:start + 500]
+                placeholders = ','.join('?' * len(batch))
+                cursor.execute(
+                    f'SELECT ID, Name, PublicKey FROM clients WHERE Name IN ({placeholders})',
+                    batch
+                )
+                for row in cursor.fetchall():
+                    found[row['Name']] = (row['ID'], row['PublicKey'])
+            
+            return found
+            
+        finally:
+            self.close()
+    
     def update_last_seen(self, client_id):
         try:
             conn = self.connect()
@@ -153,6 +229,7 @@ class Database:
             
             message_id = cursor.lastrowid
             conn.commit()
+            self.arrivals.notify([to_client])
             
             logger.info(f"Message {message_id} saved from {from_client.hex()} to {to_client.hex()}")
             return message_id
@@ -160,6 +237,144 @@ class Database:
         finally:
             self.close()
     
+    def save_messages(self, from_client, records):
+        """Stores (to_client, type, content) records in one transaction.
+        Returns the message IDs in order, 0 where the recipient is unknown."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            known = set()
+            recipients = list({to_client for to_client, _, _ in records})
+            for start in range(0, len(recipients), 500):
+                batch = recipients[start:start + 500]
+                placeholders = ','.join('?' * len(batch))
+                cursor.execute(f'SELECT ID FROM clients WHERE ID IN ({placeholders})', batch)
+                known.update(bytes(row['ID']) for row in cursor.fetchall())
+            
+            message_ids = []
+            for to_client, msg_type, content in records:
+                if to_client not in known:
+                    message_ids.append(0)
+                    continue
+                cursor.execute('''
+                    INSERT INTO messages (ToClient, FromClient, Type, Content)
+                    VALUES (?, ?, ?, ?)
+                ''', (to_client, from_client, msg_type, content))
+                message_ids.append(cursor.lastrowid)
+            
+            conn.commit()
+            self.arrivals.notify({to_client for (to_client, _, _), message_id in zip(records, message_ids) if message_id})
+            
+            logger.info(f"Saved {len(records) - message_ids.count(0)} of {len(records)} batched messages from {from_client.hex()}")
+            return message_ids
+            
+        finally:
+            self.close()
+    
+    def save_file_chunk(self, from_client, to_client, transfer_id, chunk_index, content):
+        """Stores one chunk of an unpublished transfer. Returns False if a
+        later chunk doesn't follow the transfer's previous one to the same
+        recipient, or if the chunk is already stored, which means another
+        transfer from this client has the same ID."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            if chunk_index > 0:
+                cursor.execute('''
+                    SELECT 1 FROM file_chunks
+                    WHERE FromClient = ? AND ToClient = ? AND TransferID = ? AND ChunkIndex = ?
+                    AND MessageID IS NULL
+                ''', (from_client, to_client, transfer_id, chunk_index - 1))
+                if cursor.fetchone() is None:
+                    logger.error(f"Chunk {chunk_index} of transfer {transfer_id} doesn't follow a stored chunk to {to_client.hex()}")
+                    return False
+            
+            try:
+                cursor.execute('''
+                    INSERT INTO file_chunks
+                    (FromClient, ToClient, TransferID, ChunkIndex, MessageID, Content)
+                    VALUES (?, ?, ?, ?, NULL, ?)
+                ''', (from_client, to_client, transfer_id, chunk_index, content))
+            except sqlite3.IntegrityError:
+                logger.error(f"Chunk {chunk_index} of transfer {transfer_id} from {from_client.hex()} is already stored")
+                return False
+            
+            conn.commit()
+            return True
+            
+        finally:
+            self.close()
+    
+    def finalize_file_transfer(self, from_client, to_client, transfer_id, chunk_count, msg_type):
+        """Publishes a complete transfer as one message of msg_type, which
+        records the chunks' framing; returns its ID or None if chunks are missing."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            cursor.execute('''
+                SELECT COUNT(*), COALESCE(SUM(LENGTH(Content)), 0) FROM file_chunks
+                WHERE FromClient = ? AND ToClient = ? AND TransferID = ? AND MessageID IS NULL
+            ''', (from_client, to_client, transfer_id))
+            stored_count, total_size = cursor.fetchone()
+            
+            if stored_count != chunk_count:
+                logger.error(f"Transfer {transfer_id} has {stored_count} of {chunk_count} chunks")
+                return None
+            
+            cursor.execute('''
+                INSERT INTO messages (ToClient, FromClient, Type, Content)
+                VALUES (?, ?, ?, ?)
+            ''', (to_client, from_client, msg_type, pack_file_descriptor(chunk_count, total_size)))
+            message_id = cursor.lastrowid
+            
+            cursor.execute('''
+                UPDATE file_chunks SET MessageID = ?
+                WHERE FromClient = ? AND TransferID = ? AND MessageID IS NULL
+            ''', (message_id, from_client, transfer_id))
+            
+            conn.commit()
+            self.arrivals.notify([to_client])
+            
+            logger.info(f"File transfer {transfer_id} published as message {message_id} ({total_size} bytes)")
+            return message_id
+            
+        finally:
+            self.close()
+    
+    def get_file_chunk(self, to_client, message_id, chunk_index):
+        """Returns a chunk addressed to to_client, or None. Chunks stay until
+        their message is acknowledged, so a failed download can be repeated.
+        Chunks of a message REQ_WAITING_MESSAGES already deleted are removed
+        as they are read."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            cursor.execute('''
+                SELECT Content FROM file_chunks
+                WHERE MessageID = ? AND ChunkIndex = ? AND ToClient = ?
+            ''', (message_id, chunk_index, to_client))
+            row = cursor.fetchone()
+            
+            if row is None:
+                return None
+            
+            cursor.execute('SELECT 1 FROM messages WHERE ID = ?', (message_id,))
+            if cursor.fetchone() is None:
+                cursor.execute('''
+                    DELETE FROM file_chunks
+                    WHERE MessageID = ? AND ChunkIndex = ? AND ToClient = ?
+                ''', (message_id, chunk_index, to_client))
+                conn.commit()
+            
+            return row['Content'] if row['Content'] else b''
+            
+        finally:
+            self.close()
+    
     def get_client_messages(self, client_id):
         try:
             conn = self.connect()
@@ -186,16 +401,88 @@ class Database:
         finally:
             self.close()
     
-    def delete_messages(self, client_id):
+    def has_messages_after(self, client_id, after_id):
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            cursor.execute('SELECT 1 FROM messages WHERE ToClient = ? AND ID > ? LIMIT 1', (client_id, after_id))
+            return cursor.fetchone() is not None
+            
+        finally:
+            self.close()
+    
+    def get_message_page(self, client_id, after_id, max_count, max_bytes):
+        """Returns (messages, more): client_id's messages with an ID above
+        after_id, oldest first, stopping at max_count messages or before
+        content would pass max_bytes. The first message is always included so
+        one larger than max_bytes can't hold up the mailbox."""
+        try:
+            conn = self.connect()
+            cursor = conn.cursor()
+            
+            # Sizes first, so content past the page is never loaded
+            cursor.execute('''
+                SELECT ID, LENGTH(Content) AS Size
+                FROM messages
+                WHERE ToClient = ? AND ID > ?
+                ORDER BY ID
+                LIMIT ?
+            ''', (client_id, after_id, max_count + 1))
+            sizes = cursor.fetchall()
+            
+            last_id = None
+            total = 0
+            taken = 0
+            for row in sizes[:max_count]:
+                size = row['Size'] or 0
+                if taken > 0 and total + size > max_bytes:
+                    break
+                total += size
+                taken += 1
+                last_id = row['ID']
+            
+            if last_id is None:
+                return [], False
+            
+            cursor.execute('''
+                SELECT ID, FromClient, Type, Content
+                FROM messages
+                WHERE ToClient = ? AND ID > ? AND ID <= ?
+                ORDER BY ID
+            ''', (client_id, after_id, last_id))
+            
+            messages = [{
+                'id': row['ID'],
+                'from_client': row['FromClient'],
+                'type': row['Type'],
+                'content': row['Content'] if row['Content'] else b''
+            } for row in cursor.fetchall()]
+            
+            return messages, taken < len(sizes)
+            
+        finally:
+            self.close()
+    
+    def delete_messages(self, client_id, through_id, keep_chunks=False):
+        """Deletes client_id's messages with IDs up to through_id, and the
+        chunks of the chunked files among them unless keep_chunks is set.
+        Returns how many messages there were."""
         try:
             conn = self.connect()
             cursor = conn.cursor()
             
-            cursor.execute('DELETE FROM messages WHERE ToClient = ?', (client_id,))
+            cursor.execute('DELETE FROM messages WHERE ToClient = ? AND ID <= ?', (client_id, through_id))
             deleted_count = cursor.rowcount
+            if not keep_chunks:
+                cursor.execute('''
+                    DELETE FROM file_chunks
+                    WHERE ToClient = ? AND MessageID IS NOT NULL AND MessageID <= ?
+                ''', (client_id, through_id))
             
             conn.commit()
             logger.info(f"Deleted {deleted_count} messages for client {client_id.hex()}")
+            return deleted_count
             
         finally:
             self.close()
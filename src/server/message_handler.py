@@ -27,12 +27,32 @@ class MessageHandler:
                 return self._handle_register(payload)
             elif code == REQ_CLIENT_LIST:
                 return self._handle_client_list(client_id)
+            elif code == REQ_CLIENT_LIST_SINCE:
+                return self._handle_client_list_since(client_id, payload)
+            elif code == REQ_LOOKUP_CLIENTS:
+                return self._handle_lookup_clients(client_id, payload)
             elif code == REQ_PUBLIC_KEY:
                 return self._handle_public_key(client_id, payload)
             elif code == REQ_SEND_MESSAGE:
                 return self._handle_send_message(client_id, code, payload)
+            elif code == REQ_SEND_BATCH:
+                return self._handle_send_batch(client_id, payload)
+            elif code == REQ_SEND_FILE_CHUNK:
+                return self._handle_file_chunk(client_id, payload, MSG_TYPE_FILE_CHUNKED)
+            elif code == REQ_SEND_FILE_CHUNK_IV:
+                return self._handle_file_chunk(client_id, payload, MSG_TYPE_FILE_CHUNKED_IV)
+            elif code == REQ_SEND_FILE_CHUNK_COMPRESSED:
+                return self._handle_file_chunk(client_id, payload, MSG_TYPE_FILE_CHUNKED_COMPRESSED)
+            elif code == REQ_FETCH_FILE_CHUNK:
+                return self._handle_fetch_file_chunk(client_id, payload)
             elif code == REQ_WAITING_MESSAGES:
                 return self._handle_waiting_messages(client_id)
+            elif code == REQ_MESSAGE_PAGE:
+                return self._handle_message_page(client_id, payload)
+            elif code == REQ_ACK_MESSAGES:
+                return self._handle_ack_messages(client_id, payload)
+            elif code == REQ_WAIT_MESSAGES:
+                return self._handle_wait_messages(client_id, payload)
             elif code == REQ_EXIT:
                 return b''
             else:
@@ -52,7 +72,7 @@ class MessageHandler:
             name_bytes = payload[:USERNAME_MAX_SIZE]
             public_key = payload[USERNAME_MAX_SIZE:USERNAME_MAX_SIZE + PUBLIC_KEY_SIZE]
             
-            name = name_bytes.split(b'\x00')[0].decode('ascii', errors='ignore')
+            name = unpack_name(name_bytes)
             
             if not name:
                 logger.error("Empty username")
@@ -77,9 +97,7 @@ class MessageHandler:
             
             clients = self.db.get_all_clients()
             
-            payload = b''
-            for cid, name in clients:
-                payload += pack_client_info(cid, name)
+            payload = b''.join(pack_client_info(cid, name) for cid, name in clients)
             
             logger.info(f"Sending list of {len(clients)} clients")
             return pack_response(RES_CLIENT_LIST, payload)
@@ -88,6 +106,55 @@ class MessageHandler:
             logger.error(f"Client list error: {e}", exc_info=True)
             return self._error_response()
     
+    def _handle_client_list_since(self, client_id, payload):
+        try:
+            self.db.update_last_seen(client_id)
+            
+            if len(payload) < 4:
+                logger.error("Invalid client list cursor")
+                return self._error_response()
+            
+            cursor = struct.unpack('<I', payload[:4])[0]
+            new_cursor, clients = self.db.get_clients_since(cursor)
+            
+            response_payload = struct.pack('<I', new_cursor)
+            response_payload += b''.join(pack_client_info(cid, name) for cid, name in clients)
+            
+            logger.info(f"Sending {len(clients)} clients registered after cursor {cursor}")
+            return pack_response(RES_CLIENT_LIST_SINCE, response_payload)
+            
+        except Exception as e:
+            logger.error(f"Client list error: {e}", exc_info=True)
+            return self._error_response()
+    
+    def _handle_lookup_clients(self, client_id, payload):
+        try:
+            self.db.update_last_seen(client_id)
+            
+            if not payload or len(payload) % USERNAME_MAX_SIZE != 0:
+                logger.error("Invalid lookup payload size")
+                return self._error_response()
+            
+            names = [
+                unpack_name(payload[offset:offset + USERNAME_MAX_SIZE])
+                for offset in range(0, len(payload), USERNAME_MAX_SIZE)
+            ]
+            found = self.db.get_clients_by_names(names)
+            
+            # One entry per requested name, in order; unknown names get a zero ID
+            not_found = b'\x00' * (CLIENT_ID_SIZE + PUBLIC_KEY_SIZE)
+            response_payload = b''.join(
+                found[name][0] + found[name][1] if name in found else not_found
+                for name in names
+            )
+            
+            logger.info(f"Resolved {len(found)} of {len(names)} names")
+            return pack_response(RES_LOOKUP_CLIENTS, response_payload)
+            
+        except Exception as e:
+            logger.error(f"Lookup error: {e}", exc_info=True)
+            return self._error_response()
+    
     def _handle_public_key(self, client_id, payload):
         try:
             self.db.update_last_seen(client_id)
@@ -131,8 +198,11 @@ class MessageHandler:
             
             logger.info(f"Sending {len(messages)} waiting messages to {client_id.hex()}")
             
+            # Only what was read; anything that arrived since stays queued.
+            # This request has no acknowledgement, so chunks of chunked files
+            # are kept for the client to fetch and go as they are read.
             if messages:
-                self.db.delete_messages(client_id)
+                self.db.delete_messages(client_id, messages[-1]['id'], keep_chunks=True)
             
             return pack_response(RES_WAITING_MESSAGES, payload)
             
@@ -140,6 +210,75 @@ class MessageHandler:
             logger.error(f"Waiting messages error: {e}", exc_info=True)
             return self._error_response()
     
+    def _handle_message_page(self, client_id, payload):
+        try:
+            self.db.update_last_seen(client_id)
+            
+            if len(payload) < 12:
+                logger.error("Invalid message page request")
+                return self._error_response()
+            
+            # Nothing is deleted here; the client acknowledges with REQ_ACK_MESSAGES
+            after_id, max_count, max_bytes = struct.unpack('<III', payload[:12])
+            return self._message_page(client_id, after_id, max_count, max_bytes)
+            
+        except Exception as e:
+            logger.error(f"Message page error: {e}", exc_info=True)
+            return self._error_response()
+    
+    def _handle_wait_messages(self, client_id, payload):
+        try:
+            self.db.update_last_seen(client_id)
+            
+            if len(payload) < 16:
+                logger.error("Invalid wait request")
+                return self._error_response()
+            
+            # REQ_MESSAGE_PAGE that, when the page would be empty, holds the
+            # request until a message arrives or timeout_ms passes. This ties
+            # up the connection's thread, so clients wait on a connection of their own.
+            after_id, timeout_ms, max_count, max_bytes = struct.unpack('<IIII', payload[:16])
+            timeout = min(timeout_ms, MAX_WAIT_MS) / 1000.0
+            
+            with self.db.arrivals.watch(client_id) as watch:
+                if not self.db.has_messages_after(client_id, after_id):
+                    watch.wait(timeout)
+            
+            return self._message_page(client_id, after_id, max_count, max_bytes)
+            
+        except Exception as e:
+            logger.error(f"Wait messages error: {e}", exc_info=True)
+            return self._error_response()
+    
+    def _message_page(self, client_id, after_id, max_count, max_bytes):
+        max_count = min(max_count, MAX_PAGE_MESSAGES) if max_count else MAX_PAGE_MESSAGES
+        max_bytes = min(max_bytes, MAX_PAGE_BYTES) if max_bytes else MAX_PAGE_BYTES
+        
+        messages, more = self.db.get_message_page(client_id, after_id, max_count, max_bytes)
+        
+        response_payload = struct.pack('<B', 1 if more else 0) + b''.join(
+            pack_message_info(msg['from_client'], msg['id'], msg['type'], msg['content'])
+            for msg in messages
+        )
+        
+        logger.info(f"Sending page of {len(messages)} messages after {after_id} to {client_id.hex()}")
+        return pack_response(RES_MESSAGE_PAGE, response_payload)
+    
+    def _handle_ack_messages(self, client_id, payload):
+        try:
+            if len(payload) < 4:
+                logger.error("Invalid acknowledgement")
+                return self._error_response()
+            
+            through_id = struct.unpack('<I', payload[:4])[0]
+            deleted = self.db.delete_messages(client_id, through_id)
+            
+            return pack_response(RES_MESSAGES_ACKED, struct.pack('<I', deleted))
+            
+        except Exception as e:
+            logger.error(f"Acknowledgement error: {e}", exc_info=True)
+            return self._error_response()
+    
     def _handle_send_message(self, from_client_id, code, payload):
         try:
             self.db.update_last_seen(from_client_id)
@@ -168,6 +307,109 @@ class MessageHandler:
             logger.error(f"Send message error: {e}", exc_info=True)
             return self._error_response()
     
+    def _handle_send_batch(self, from_client_id, payload):
+        try:
+            self.db.update_last_seen(from_client_id)
+            
+            if len(payload) < 4:
+                logger.error("Invalid batch payload")
+                return self._error_response()
+            
+            count = struct.unpack('<I', payload[:4])[0]
+            if count > MAX_BATCH_MESSAGES:
+                logger.error(f"Batch of {count} messages exceeds limit")
+                return self._error_response()
+            
+            records = []
+            offset = 4
+            record_header_size = CLIENT_ID_SIZE + 1 + 4
+            for _ in range(count):
+                if offset + record_header_size > len(payload):
+                    logger.error("Truncated batch record")
+                    return self._error_response()
+                to_client_id = bytes(payload[offset:offset + CLIENT_ID_SIZE])
+                msg_type = payload[offset + CLIENT_ID_SIZE]
+                content_size = struct.unpack('<I', payload[offset + CLIENT_ID_SIZE + 1:offset + record_header_size])[0]
+                offset += record_header_size
+                if offset + content_size > len(payload):
+                    logger.error("Truncated batch record content")
+                    return self._error_response()
+                records.append((to_client_id, msg_type, bytes(payload[offset:offset + content_size])))
+                offset += content_size
+            
+            message_ids = self.db.save_messages(from_client_id, records)
+            
+            # Unknown recipients get message ID 0 instead of failing the whole batch
+            response_payload = struct.pack('<I', count) + b''.join(
+                to_client_id + struct.pack('<I', message_id)
+                for (to_client_id, _, _), message_id in zip(records, message_ids)
+            )
+            
+            logger.info(f"Batch of {count} messages sent from {from_client_id.hex()}")
+            return pack_response(RES_BATCH_SENT, response_payload)
+            
+        except Exception as e:
+            logger.error(f"Send batch error: {e}", exc_info=True)
+            return self._error_response()
+    
+    def _handle_file_chunk(self, from_client_id, payload, msg_type):
+        try:
+            header_size = CLIENT_ID_SIZE + 4 + 4 + 1 + 4
+            if len(payload) < header_size:
+                logger.error("Invalid file chunk payload")
+                return self._error_response()
+            
+            to_client_id = payload[:CLIENT_ID_SIZE]
+            transfer_id, chunk_index, is_last, content_size = struct.unpack(
+                '<IIBI', payload[CLIENT_ID_SIZE:header_size]
+            )
+            content = payload[header_size:header_size + content_size]
+            
+            # Later chunks are checked against the transfer's earlier ones
+            if chunk_index == 0:
+                self.db.update_last_seen(from_client_id)
+                if not self.db.client_exists(to_client_id):
+                    logger.error(f"Recipient {to_client_id.hex()} does not exist")
+                    return self._error_response()
+            
+            if not self.db.save_file_chunk(from_client_id, to_client_id, transfer_id, chunk_index, content):
+                return self._error_response()
+            
+            message_id = 0
+            if is_last:
+                message_id = self.db.finalize_file_transfer(
+                    from_client_id, to_client_id, transfer_id, chunk_index + 1, msg_type
+                )
+                if message_id is None:
+                    return self._error_response()
+            
+            response_payload = struct.pack('<III', transfer_id, chunk_index, message_id)
+            return pack_response(RES_FILE_CHUNK_STORED, response_payload)
+            
+        except Exception as e:
+            logger.error(f"File chunk error: {e}", exc_info=True)
+            return self._error_response()
+    
+    def _handle_fetch_file_chunk(self, client_id, payload):
+        try:
+            if len(payload) < 8:
+                logger.error("Invalid fetch chunk payload")
+                return self._error_response()
+            
+            message_id, chunk_index = struct.unpack('<II', payload[:8])
+            content = self.db.get_file_chunk(client_id, message_id, chunk_index)
+            
+            if content is None:
+                logger.error(f"Chunk {chunk_index} of message {message_id} not found")
+                return self._error_response()
+            
+            response_payload = struct.pack('<III', message_id, chunk_index, len(content)) + content
+            return pack_response(RES_FILE_CHUNK, response_payload)
+            
+        except Exception as e:
+            logger.error(f"Fetch chunk error: {e}", exc_info=True)
+            return self._error_response()
+    
     def _error_response(self):
         return pack_response(RES_GENERAL_ERROR, b'')
 
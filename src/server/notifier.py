@@ -0,0 +1,64 @@
+import threading
+
+class MailboxNotifier:
+    """Lets a request thread sleep until a message for a given client is
+    stored. Only clients with a waiter have an entry, so stores for everyone
+    else cost one dictionary lookup."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        # client_id -> _Mailbox, while at least one request watches it
+        self.mailboxes = {}
+
+    def watch(self, client_id):
+        """Starts watching client_id's mailbox. Use as a context manager and
+        check the database inside it, so a message stored between that check
+        and wait() still wakes the waiter."""
+        return _Watch(self, bytes(client_id))
+
+    def notify(self, client_ids):
+        with self.lock:
+            for client_id in client_ids:
+                mailbox = self.mailboxes.get(bytes(client_id))
+                if mailbox is not None:
+                    mailbox.arrivals += 1
+                    mailbox.condition.notify_all()
+
+class _Mailbox:
+    def __init__(self, lock):
+        self.condition = threading.Condition(lock)
+        self.arrivals = 0
+        self.watchers = 0
+
+class _Watch:
+    def __init__(self, notifier, client_id):
+        self.notifier = notifier
+        self.client_id = client_id
+        self.mailbox = None
+        self.seen = 0
+
+    def __enter__(self):
+        with self.notifier.lock:
+            mailbox = self.notifier.mailboxes.get(self.client_id)
+            if mailbox is None:
+                mailbox = _Mailbox(self.notifier.lock)
+                self.notifier.mailboxes[self.client_id] = mailbox
+            mailbox.watchers += 1
+            self.mailbox = mailbox
+            self.seen = mailbox.arrivals
+        return self
+
+    def __exit__(self, *exc):
+        with self.notifier.lock:
+            self.mailbox.watchers -= 1
+            if self.mailbox.watchers == 0:
+                del self.notifier.mailboxes[self.client_id]
+        return False
+
+    def wait(self, timeout):
+        """True if a message arrived since the watch started or since the
+        last wait() that returned True; False on timeout."""
+        with self.notifier.lock:
+            arrived = self.mailbox.condition.wait_for(lambda: self.mailbox.arrivals != self.seen, timeout)
+            self.seen = self.mailbox.arrivals
+            return arrived
@@ -4,6 +4,18 @@ REQ_CLIENT_LIST = 601
 REQ_PUBLIC_KEY = 602
 REQ_SEND_MESSAGE = 603
 REQ_WAITING_MESSAGES = 604
+REQ_CLIENT_LIST_SINCE = 605
+REQ_LOOKUP_CLIENTS = 606
+REQ_SEND_FILE_CHUNK = 607
+REQ_FETCH_FILE_CHUNK = 608
+REQ_SEND_BATCH = 609
+REQ_MESSAGE_PAGE = 610
+REQ_ACK_MESSAGES = 611
+REQ_WAIT_MESSAGES = 612
+# REQ_SEND_FILE_CHUNK for chunks that carry their own IV
+REQ_SEND_FILE_CHUNK_IV = 613
+# REQ_SEND_FILE_CHUNK_IV for chunks the client compressed before encrypting
+REQ_SEND_FILE_CHUNK_COMPRESSED = 614
 REQ_EXIT = 0
 
 # Response codes
@@ -12,6 +24,13 @@ RES_CLIENT_LIST = 2101
 RES_PUBLIC_KEY = 2102
 RES_MESSAGE_SENT = 2103
 RES_WAITING_MESSAGES = 2104
+RES_CLIENT_LIST_SINCE = 2105
+RES_LOOKUP_CLIENTS = 2106
+RES_FILE_CHUNK_STORED = 2107
+RES_FILE_CHUNK = 2108
+RES_BATCH_SENT = 2109
+RES_MESSAGE_PAGE = 2110
+RES_MESSAGES_ACKED = 2111
 RES_GENERAL_ERROR = 9000
 
 # Message types
@@ -19,6 +38,14 @@ MSG_TYPE_SYM_KEY_REQUEST = 1
 MSG_TYPE_SYM_KEY_SEND = 2
 MSG_TYPE_TEXT_MESSAGE = 3
 MSG_TYPE_FILE = 4
+MSG_TYPE_FILE_CHUNKED = 5
+# Compressed before encryption; stored and relayed like any other type
+MSG_TYPE_TEXT_COMPRESSED = 6
+MSG_TYPE_FILE_COMPRESSED = 7
+# Published from REQ_SEND_FILE_CHUNK_IV transfers; chunks are IV + ciphertext
+MSG_TYPE_FILE_CHUNKED_IV = 8
+# Published from REQ_SEND_FILE_CHUNK_COMPRESSED transfers
+MSG_TYPE_FILE_CHUNKED_COMPRESSED = 9
 
 VERSION = 2
 HEADER_SIZE = 23
@@ -26,6 +53,12 @@ CLIENT_ID_SIZE = 16
 UUID_SIZE = 16
 USERNAME_MAX_SIZE = 255
 PUBLIC_KEY_SIZE = 160
+MAX_BATCH_MESSAGES = 1000
+# Upper bounds for one RES_MESSAGE_PAGE; clients may ask for less
+MAX_PAGE_MESSAGES = 1000
+MAX_PAGE_BYTES = 16 * 1024 * 1024
+# Longest a REQ_WAIT_MESSAGES request is held open
+MAX_WAIT_MS = 60 * 1000
 
 class ProtocolError(Exception):
     pass
@@ -59,6 +92,13 @@ def pack_client_info(client_id, name):
     name_bytes += b'\x00' * (USERNAME_MAX_SIZE - len(name_bytes))
     return client_id + name_bytes
 
+def pack_file_descriptor(chunk_count, total_size):
+    import struct
+    return struct.pack('<IQ', chunk_count, total_size)
+
+def unpack_name(name_bytes):
+    return name_bytes.split(b'\x00')[0].decode('ascii', errors='ignore')
+
 def pack_message_info(client_id, message_id, msg_type, content):
     import struct
     content_size = len(content)
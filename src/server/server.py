@@ -111,14 +111,17 @@ class MessageUServer:
             import struct
             payload_size = struct.unpack('<I', header_data[19:23])[0]
             
-            payload_data = b''
+            # Grown as bytes arrive rather than sized from the header, so a
+            # header claiming a huge payload costs nothing until it is sent
+            payload_data = bytearray()
             while len(payload_data) < payload_size:
-                chunk = client_socket.recv(min(4096, payload_size - len(payload_data)))
+                chunk = client_socket.recv(min(65536, payload_size - len(payload_data)))
                 if not chunk:
-                    break
+                    # Truncated request: don't hand a partial payload to the handler
+                    return None
                 payload_data += chunk
             
-            return header_data + payload_data
+            return header_data + bytes(payload_data)
             
         except Exception as e:
             logger.error(f"Error receiving data: {e}")